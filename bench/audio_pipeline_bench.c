@@ -0,0 +1,204 @@
+/*
+ * Copyright (c) 2020 Raspberry Pi (Trading) Ltd.
+ *
+ * SPDX-License-Identifier: BSD-3-Clause
+ */
+
+// Measures sdl_audio.c throughput: each conversion path on its own, and producer buffers given end to end through
+// audio_i2s_connect into a null device (the free running file backend writing to /dev/null). Writes JSON to stdout
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/wait.h>
+#include "pico.h"
+#include "pico/audio.h"
+#include "pico/audio_i2s.h"
+#include "pico/host_audio.h"
+#include "pico/host_audio_pipeline.h"
+#include "pico/host_video.h"
+#include "bench_common.h"
+
+// run directly rather than on the simulated core 0 (see pico_host_sdl.h)
+#undef main
+
+// sdl_audio.c's hooks into the video side, which isn't linked
+float (*host_video_audio_queue_fill_fn)(void);
+bool (*host_video_audio_clock_fn)(uint64_t *us);
+
+#define DEVICE_RATE 44100
+#define DEVICE_CHANNELS 2
+#define BUFFER_SAMPLES 256
+#define BUFFER_COUNT 3
+#define MIN_SECONDS 0.25
+
+// counts heap allocations made by anything linked into the benchmark (the link wraps these where supported)
+static uint64_t allocations;
+
+#if AUDIO_BENCH_COUNT_ALLOCATIONS
+void *__real_malloc(size_t size);
+void *__real_calloc(size_t count, size_t size);
+void *__real_realloc(void *ptr, size_t size);
+
+void *__wrap_malloc(size_t size) {
+    allocations++;
+    return __real_malloc(size);
+}
+
+void *__wrap_calloc(size_t count, size_t size) {
+    allocations++;
+    return __real_calloc(count, size);
+}
+
+void *__wrap_realloc(void *ptr, size_t size) {
+    allocations++;
+    return __real_realloc(ptr, size);
+}
+#endif
+
+struct variant {
+    const char *name;
+    uint16_t format;
+    enum host_audio_sample_format sample_format;
+    uint sample_bytes;
+    uint16_t channels;
+    uint32_t rate;
+};
+
+static const struct variant variants[] = {
+        {"s8_mono_22050",    AUDIO_BUFFER_FORMAT_PCM_S8,  HOST_AUDIO_SAMPLE_S8,  1, 1, 22050},
+        {"s8_mono_44100",    AUDIO_BUFFER_FORMAT_PCM_S8,  HOST_AUDIO_SAMPLE_S8,  1, 1, 44100},
+        {"s8_stereo_44100",  AUDIO_BUFFER_FORMAT_PCM_S8,  HOST_AUDIO_SAMPLE_S8,  1, 2, 44100},
+        {"s8_stereo_48000",  AUDIO_BUFFER_FORMAT_PCM_S8,  HOST_AUDIO_SAMPLE_S8,  1, 2, 48000},
+        {"s16_mono_22050",   AUDIO_BUFFER_FORMAT_PCM_S16, HOST_AUDIO_SAMPLE_S16, 2, 1, 22050},
+        {"s16_mono_44100",   AUDIO_BUFFER_FORMAT_PCM_S16, HOST_AUDIO_SAMPLE_S16, 2, 1, 44100},
+        {"s16_mono_48000",   AUDIO_BUFFER_FORMAT_PCM_S16, HOST_AUDIO_SAMPLE_S16, 2, 1, 48000},
+        {"s16_stereo_22050", AUDIO_BUFFER_FORMAT_PCM_S16, HOST_AUDIO_SAMPLE_S16, 2, 2, 22050},
+        {"s16_stereo_44100", AUDIO_BUFFER_FORMAT_PCM_S16, HOST_AUDIO_SAMPLE_S16, 2, 2, 44100},
+        {"s16_stereo_48000", AUDIO_BUFFER_FORMAT_PCM_S16, HOST_AUDIO_SAMPLE_S16, 2, 2, 48000},
+};
+
+static void fill_synthetic(uint8_t *bytes, uint count) {
+    srand(1);
+    for (uint i = 0; i < count; i++) {
+        bytes[i] = (uint8_t) rand();
+    }
+}
+
+// host_audio_pipeline_process alone; samples (as elsewhere in the audio API) are frames of the producer's format
+static void bench_conversion(const struct variant *v) {
+    static uint8_t input[BUFFER_SAMPLES * 2 * 2];
+    // enough for the largest upsampling ratio
+    static int16_t output[BUFFER_SAMPLES * 4 * DEVICE_CHANNELS];
+    struct host_audio_pipeline_config config = {
+            .input_format = v->sample_format,
+            .input_channels = v->channels,
+            .input_rate = v->rate,
+            .output_channels = DEVICE_CHANNELS,
+            .output_rate = DEVICE_RATE,
+    };
+    fill_synthetic(input, sizeof(input));
+    struct host_audio_pipeline *pipeline = host_audio_pipeline_create(&config);
+    uint frame_bytes = v->sample_bytes * v->channels;
+    uint64_t samples = 0;
+    uint64_t allocations_before = allocations;
+    double start = now_seconds(), elapsed;
+    do {
+        for (int r = 0; r < 64; r++) {
+            uint pos = 0;
+            while (pos < BUFFER_SAMPLES) {
+                uint used;
+                host_audio_pipeline_process(pipeline, input + pos * frame_bytes, BUFFER_SAMPLES - pos, &used, output,
+                                            count_of(output) / DEVICE_CHANNELS);
+                pos += used;
+            }
+        }
+        samples += 64 * BUFFER_SAMPLES;
+        elapsed = now_seconds() - start;
+    } while (elapsed < MIN_SECONDS);
+    uint64_t loop_allocations = allocations - allocations_before;
+    host_audio_pipeline_destroy(pipeline);
+    printf("    {\"variant\": \"%s\", \"ns_per_sample\": %.3f, \"msamples_per_second\": %.3f, "
+           "\"allocations\": %llu}", v->name, elapsed * 1e9 / samples, samples / elapsed / 1e6,
+           (unsigned long long) loop_allocations);
+}
+
+// a fresh process for each variant, as the device format is fixed by the first setup
+static void bench_end_to_end(const struct variant *v) {
+    static const struct audio_format device_format = {
+            .sample_freq = DEVICE_RATE,
+            .format = AUDIO_BUFFER_FORMAT_PCM_S16,
+            .channel_count = DEVICE_CHANNELS,
+    };
+    struct audio_format producer_format = {
+            .sample_freq = v->rate,
+            .format = v->format,
+            .channel_count = v->channels,
+    };
+    struct audio_buffer_format producer_buffer_format = {
+            .format = &producer_format,
+            .sample_stride = (uint16_t) (v->sample_bytes * v->channels),
+    };
+    host_audio_set_output_file("/dev/null", false);
+    uint64_t allocations_before = allocations;
+    struct audio_buffer_pool *producer_pool = audio_new_producer_pool(&producer_buffer_format, BUFFER_COUNT,
+                                                                      BUFFER_SAMPLES);
+    if (!audio_i2s_setup(&device_format, NULL) || !audio_i2s_connect(producer_pool)) {
+        fprintf(stderr, "%s: audio setup failed\n", v->name);
+        exit(1);
+    }
+    audio_i2s_set_enabled(true);
+    uint64_t setup_allocations = allocations - allocations_before;
+
+    uint64_t buffers = 0;
+    allocations_before = allocations;
+    double start = now_seconds(), elapsed;
+    do {
+        for (int r = 0; r < 64; r++) {
+            struct audio_buffer *buffer = take_audio_buffer(producer_pool, true);
+            if (!buffers) fill_synthetic(buffer->buffer->bytes, buffer->max_sample_count * producer_buffer_format.sample_stride);
+            buffer->sample_count = buffer->max_sample_count;
+            give_audio_buffer(producer_pool, buffer);
+        }
+        buffers += 64;
+        elapsed = now_seconds() - start;
+    } while (elapsed < MIN_SECONDS);
+    uint64_t loop_allocations = allocations - allocations_before;
+    struct host_audio_stats stats;
+    host_audio_get_stats(&stats);
+    printf("    {\"variant\": \"%s\", \"buffers_per_second\": %.1f, \"ns_per_sample\": %.3f, "
+           "\"device_writes\": %u, \"setup_allocations\": %llu, \"allocations\": %llu}", v->name, buffers / elapsed,
+           elapsed * 1e9 / (buffers * BUFFER_SAMPLES), stats.device_writes, (unsigned long long) setup_allocations,
+           (unsigned long long) loop_allocations);
+}
+
+int main(int argc, char **argv) {
+    printf("{\n  \"device\": {\"rate\": %u, \"channels\": %u},\n  \"buffer_samples\": %u,\n"
+           "  \"allocations_counted\": %s,\n  \"conversions\": [\n", DEVICE_RATE, DEVICE_CHANNELS, BUFFER_SAMPLES,
+           AUDIO_BENCH_COUNT_ALLOCATIONS ? "true" : "false");
+    for (uint i = 0; i < count_of(variants); i++) {
+        bench_conversion(variants + i);
+        printf(i + 1 < count_of(variants) ? ",\n" : "\n");
+    }
+    printf("  ],\n  \"end_to_end\": [\n");
+    int rc = 0;
+    for (uint i = 0; i < count_of(variants); i++) {
+        fflush(stdout);
+        pid_t pid = fork();
+        if (!pid) {
+            bench_end_to_end(variants + i);
+            fflush(stdout);
+            exit(0);
+        }
+        int status;
+        if (pid < 0 || waitpid(pid, &status, 0) < 0 || !WIFEXITED(status) || WEXITSTATUS(status)) {
+            // the child prints nothing unless it succeeds
+            printf("    null");
+            rc = 1;
+        }
+        printf(i + 1 < count_of(variants) ? ",\n" : "\n");
+    }
+    printf("  ]\n}\n");
+    return rc;
+}
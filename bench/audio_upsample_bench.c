@@ -0,0 +1,75 @@
+/*
+ * Copyright (c) 2020 Raspberry Pi (Trading) Ltd.
+ *
+ * SPDX-License-Identifier: BSD-3-Clause
+ */
+
+// Measures audio_upsample throughput across step ratios, checking its output against the original scalar loop
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "pico.h"
+#include "bench_common.h"
+
+// run directly rather than on the simulated core 0 (see pico_host_sdl.h)
+#undef main
+
+void audio_upsample(int16_t *input, int16_t *output, uint output_count, uint32_t step);
+
+#define OUTPUT_COUNT 4096
+#define MIN_SECONDS 0.25
+
+static void reference_upsample(int16_t *input, int16_t *output, uint output_count, uint32_t step) {
+    uint32_t pos = 0;
+    for (uint i = 0; i < output_count; i++) {
+        uint32_t offset = pos >> 12u;
+        int16_t a = input[offset];
+        int16_t b = input[offset + 1];
+        *output++ = a + (((b - a) * ((pos >> 4u) & 0xff)) >> 8);
+        pos += step;
+    }
+}
+
+// returns output samples per second
+static double measure(void (*upsample)(int16_t *, int16_t *, uint, uint32_t), int16_t *input, int16_t *output,
+                      uint32_t step) {
+    uint64_t samples = 0;
+    double start = now_seconds(), elapsed;
+    do {
+        for (int r = 0; r < 64; r++) {
+            upsample(input, output, OUTPUT_COUNT, step);
+        }
+        samples += 64 * OUTPUT_COUNT;
+        elapsed = now_seconds() - start;
+    } while (elapsed < MIN_SECONDS);
+    return samples / elapsed;
+}
+
+int main(int argc, char **argv) {
+    // step is the input advance per output sample in 1/4096ths; below 4096 upsamples, above downsamples
+    static const uint32_t steps[] = {1024, 2048, 2731, 3763, 4096, 5000, 8192};
+    static int16_t input[OUTPUT_COUNT * 2 + 2];
+    static int16_t output[OUTPUT_COUNT];
+    static int16_t expected[OUTPUT_COUNT];
+    srand(1);
+    for (uint i = 0; i < count_of(input); i++) {
+        input[i] = (int16_t) (rand() & 0xffff);
+    }
+    // include the extremes, where b - a is largest
+    input[0] = -32768;
+    input[1] = 32767;
+    int rc = 0;
+    for (uint s = 0; s < count_of(steps); s++) {
+        uint32_t step = steps[s];
+        reference_upsample(input, expected, OUTPUT_COUNT, step);
+        audio_upsample(input, output, OUTPUT_COUNT, step);
+        bool match = !memcmp(output, expected, sizeof(output));
+        if (!match) rc = 1;
+        double rate = measure(audio_upsample, input, output, step);
+        double reference_rate = measure(reference_upsample, input, expected, step);
+        printf("step %5u (x%.3f): %8.1f Msamples/s (scalar %8.1f Msamples/s) %s\n", step, 4096.0 / step,
+               rate / 1e6, reference_rate / 1e6, match ? "ok" : "MISMATCH");
+    }
+    return rc;
+}
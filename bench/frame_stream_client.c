@@ -0,0 +1,286 @@
+/*
+ * Copyright (c) 2020 Raspberry Pi (Trading) Ltd.
+ *
+ * SPDX-License-Identifier: BSD-3-Clause
+ */
+
+// A viewer for the frame stream (see host_frame_stream.h), which rebuilds each frame from the key and delta frames.
+//
+//   frame_stream_client                  starts the server in process on a temporary UNIX socket, streams synthetic
+//                                        frames through it (including a resize), and checks every rebuilt frame
+//                                        against the one submitted; exits non zero on a mismatch
+//   frame_stream_client <address> [n]    connects to a running program streaming on <address> (unix:<path> or
+//                                        tcp:<port>), checks the messages are well formed while rebuilding n frames
+//                                        (default 100), and reports the frame rate and bytes received
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <sys/un.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include "pico.h"
+#include "pico/scanvideo.h"
+#include "pico/host_frame_stream.h"
+#include "sdl_le.h"
+#include "bench_common.h"
+
+// run directly rather than on the simulated core 0 (see pico_host_sdl.h)
+#undef main
+
+#define HEADER_BYTES 20
+#define RECEIVE_TIMEOUT_SECONDS 5
+
+struct viewer {
+    int fd;
+    uint width, height;
+    uint16_t *pixels; // rgb565
+    bool have_key_frame;
+    uint32_t frame_number;
+    uint64_t bytes, key_frames, delta_frames, rows;
+    uint8_t *payload;
+    size_t payload_size;
+};
+
+static bool receive_all(int fd, void *buf, size_t size) {
+    uint8_t *p = (uint8_t *) buf;
+    while (size) {
+        ssize_t n = recv(fd, p, size, 0);
+        if (n <= 0) return false;
+        p += n;
+        size -= (size_t) n;
+    }
+    return true;
+}
+
+static int connect_to(const char *address) {
+    int fd = -1;
+    if (!strncmp(address, "unix:", 5)) {
+        struct sockaddr_un addr;
+        memset(&addr, 0, sizeof(addr));
+        addr.sun_family = AF_UNIX;
+        if (strlen(address + 5) >= sizeof(addr.sun_path)) return -1;
+        strcpy(addr.sun_path, address + 5);
+        fd = socket(AF_UNIX, SOCK_STREAM, 0);
+        if (fd >= 0 && connect(fd, (struct sockaddr *) &addr, sizeof(addr)) < 0) {
+            close(fd);
+            return -1;
+        }
+    } else if (!strncmp(address, "tcp:", 4)) {
+        struct sockaddr_in addr;
+        memset(&addr, 0, sizeof(addr));
+        addr.sin_family = AF_INET;
+        addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        addr.sin_port = htons((uint16_t) atoi(address + 4));
+        fd = socket(AF_INET, SOCK_STREAM, 0);
+        if (fd >= 0 && connect(fd, (struct sockaddr *) &addr, sizeof(addr)) < 0) {
+            close(fd);
+            return -1;
+        }
+    }
+    if (fd >= 0) {
+        struct timeval timeout = {.tv_sec = RECEIVE_TIMEOUT_SECONDS};
+        setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+    }
+    return fd;
+}
+
+// receives and applies the next message, returning false (having said why) if it can't be read or is malformed
+static bool viewer_receive_frame(struct viewer *v) {
+    uint8_t header[HEADER_BYTES];
+    if (!receive_all(v->fd, header, sizeof(header))) {
+        printf("Error: connection closed or timed out\n");
+        return false;
+    }
+    const uint8_t *p = header;
+    uint32_t magic = get_le(&p, 4);
+    uint type = get_le(&p, 1);
+    get_le(&p, 1);
+    uint width = get_le(&p, 2);
+    uint height = get_le(&p, 2);
+    uint row_count = get_le(&p, 2);
+    uint32_t frame_number = get_le(&p, 4);
+    uint32_t payload_bytes = get_le(&p, 4);
+    if (magic != PICO_HOST_FRAME_STREAM_MAGIC) {
+        printf("Error: bad magic %08x\n", (uint) magic);
+        return false;
+    }
+    if (type == PICO_HOST_FRAME_STREAM_KEY_FRAME) {
+        if (width != v->width || height != v->height) {
+            free(v->pixels);
+            v->width = width;
+            v->height = height;
+            v->pixels = (uint16_t *) calloc(width * height, sizeof(uint16_t));
+        }
+        v->have_key_frame = true;
+        v->key_frames++;
+    } else if (type == PICO_HOST_FRAME_STREAM_DELTA_FRAME) {
+        if (!v->have_key_frame || width != v->width || height != v->height) {
+            printf("Error: frame %u is a delta without a key frame of its size before it\n", (uint) frame_number);
+            return false;
+        }
+        v->delta_frames++;
+    } else {
+        printf("Error: frame %u has unknown type %u\n", (uint) frame_number, type);
+        return false;
+    }
+    if (payload_bytes > v->payload_size) {
+        free(v->payload);
+        v->payload = (uint8_t *) malloc(payload_bytes);
+        v->payload_size = payload_bytes;
+    }
+    if (!receive_all(v->fd, v->payload, payload_bytes)) {
+        printf("Error: connection closed or timed out in frame %u\n", (uint) frame_number);
+        return false;
+    }
+    v->bytes += HEADER_BYTES + payload_bytes;
+    p = v->payload;
+    const uint8_t *end = v->payload + payload_bytes;
+    int last_y = -1;
+    for (uint r = 0; r < row_count; r++) {
+        if (end - p < 4) goto truncated;
+        uint y = get_le(&p, 2);
+        uint run_count = get_le(&p, 2);
+        if ((int) y <= last_y || y >= height) {
+            printf("Error: frame %u has row %u out of order or range\n", (uint) frame_number, y);
+            return false;
+        }
+        last_y = (int) y;
+        if ((size_t) (end - p) < run_count * 4u) goto truncated;
+        uint16_t *row = v->pixels + y * width;
+        uint x = 0;
+        for (uint i = 0; i < run_count; i++) {
+            uint length = get_le(&p, 2);
+            uint16_t color = (uint16_t) get_le(&p, 2);
+            if (!length || x + length > width) {
+                printf("Error: frame %u row %u has runs which don't add up to its width\n", (uint) frame_number, y);
+                return false;
+            }
+            while (length--) row[x++] = color;
+        }
+        if (x != width) {
+            printf("Error: frame %u row %u has runs which don't add up to its width\n", (uint) frame_number, y);
+            return false;
+        }
+    }
+    if (type == PICO_HOST_FRAME_STREAM_KEY_FRAME && row_count != height) {
+        printf("Error: key frame %u has %u of %u rows\n", (uint) frame_number, row_count, height);
+        return false;
+    }
+    if (p != end) {
+        printf("Error: frame %u has %u bytes after its rows\n", (uint) frame_number, (uint) (end - p));
+        return false;
+    }
+    v->rows += row_count;
+    v->frame_number = frame_number;
+    return true;
+    truncated:
+    printf("Error: frame %u has a truncated row\n", (uint) frame_number);
+    return false;
+}
+
+// r, g, b are 5 bits; rgb565 repeats the top bit of green in its low bit
+static uint16_t expected_rgb565(uint r, uint g, uint b) {
+    return (uint16_t) ((r << 11u) | (g << 6u) | ((g >> 4u) << 5u) | b);
+}
+
+// a frame with a mix of long runs, single pixels and rows which only change some frames
+static void make_frame(uint16_t *pixels, uint16_t *expected, uint width, uint height, uint n) {
+    for (uint y = 0; y < height; y++) {
+        for (uint x = 0; x < width; x++) {
+            uint r, g, b;
+            if (y % 8 == 0) {
+                // changes every frame, pixel by pixel
+                r = (x + n) & 0x1f;
+                g = (x * 3 + y) & 0x1f;
+                b = n & 0x1f;
+            } else if (y % 8 == 1) {
+                // changes every fourth frame, in long runs
+                r = (x / 37 + n / 4) & 0x1f;
+                g = 0;
+                b = 0x1f;
+            } else {
+                // unchanged, apart from a dot moving down the screen
+                bool dot = y == n % height && x == (n * 7) % width;
+                r = dot ? 0x1f : y & 0x1f;
+                g = dot ? 0x1f : 0x10;
+                b = dot ? 0x1f : 0;
+            }
+            pixels[y * width + x] = (uint16_t) PICO_SCANVIDEO_PIXEL_FROM_RGB5(r, g, b);
+            expected[y * width + x] = expected_rgb565(r, g, b);
+        }
+    }
+}
+
+static int self_test(void) {
+    static const struct {
+        uint width, height, frames;
+    } sizes[] = {
+            {320, 240, 24},
+            {640, 480, 8},
+            {17,  5,   8},
+    };
+    char address[64];
+    snprintf(address, sizeof(address), "unix:/tmp/frame_stream_client.%d", (int) getpid());
+    if (!frame_stream_start(address)) return 1;
+    struct viewer v = {.fd = connect_to(address)};
+    if (v.fd < 0) {
+        printf("Error: can't connect to %s\n", address);
+        return 1;
+    }
+    // frames are only encoded once the server has seen the client
+    for (int i = 0; i < 5000 && !frame_stream_get_client_count(); i++) usleep(1000);
+    int failures = 0;
+    uint32_t number = 0;
+    for (uint s = 0; s < count_of(sizes); s++) {
+        uint width = sizes[s].width, height = sizes[s].height;
+        uint16_t *pixels = (uint16_t *) malloc(width * height * sizeof(uint16_t));
+        uint16_t *expected = (uint16_t *) malloc(width * height * sizeof(uint16_t));
+        for (uint n = 0; n < sizes[s].frames; n++, number++) {
+            make_frame(pixels, expected, width, height, n);
+            frame_stream_submit_frame(pixels, width * sizeof(uint16_t), width, height, number);
+            // one frame at a time, so none are dropped and each message can be checked against its frame
+            if (!viewer_receive_frame(&v)) return 1;
+            if (v.frame_number != number || v.width != width || v.height != height ||
+                memcmp(v.pixels, expected, width * height * sizeof(uint16_t))) {
+                printf("Error: rebuilt frame %u (%ux%u) doesn't match frame %u as submitted\n", (uint) v.frame_number,
+                       v.width, v.height, (uint) number);
+                failures++;
+            }
+        }
+        free(pixels);
+        free(expected);
+    }
+    close(v.fd);
+    unlink(address + 5);
+    printf("%u frames rebuilt: %llu key, %llu delta, %llu rows, %llu bytes; %d mismatched\n", (uint) number,
+           (unsigned long long) v.key_frames, (unsigned long long) v.delta_frames, (unsigned long long) v.rows,
+           (unsigned long long) v.bytes, failures);
+    return failures ? 1 : 0;
+}
+
+static int view(const char *address, uint frames) {
+    struct viewer v = {.fd = connect_to(address)};
+    if (v.fd < 0) {
+        printf("Error: can't connect to %s\n", address);
+        return 1;
+    }
+    double start = now_seconds();
+    for (uint i = 0; i < frames; i++) {
+        if (!viewer_receive_frame(&v)) return 1;
+    }
+    double elapsed = now_seconds() - start;
+    close(v.fd);
+    printf("%u frames of %ux%u in %.3f s: %.1f frames/s, %llu key, %llu delta, %.1f rows and %.0f bytes per frame\n",
+           frames, v.width, v.height, elapsed, frames / elapsed, (unsigned long long) v.key_frames,
+           (unsigned long long) v.delta_frames, (double) v.rows / frames, (double) v.bytes / frames);
+    return 0;
+}
+
+int main(int argc, char **argv) {
+    if (argc < 2) return self_test();
+    return view(argv[1], argc > 2 ? (uint) atoi(argv[2]) : 100);
+}
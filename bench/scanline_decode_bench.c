@@ -0,0 +1,197 @@
+/*
+ * Copyright (c) 2020 Raspberry Pi (Trading) Ltd.
+ *
+ * SPDX-License-Identifier: BSD-3-Clause
+ */
+
+// Measures the scanline decoder over synthetic composable scanlines: simulate_scanvideo_pio_video_24mhz_composable
+// and the DMA chain merges on their own, then whole frames through scanvideo_begin/end_scanline_generation. Built
+// headless, and run as firmware on the simulated core 0 (it posts the vsync itself, so frames aren't paced)
+
+#include <stdio.h>
+#include <string.h>
+#include "pico.h"
+#include "pico/scanvideo.h"
+#include "pico/scanvideo/composable_scanline.h"
+#include "SDL.h"
+#include "bench_common.h"
+
+// sdl_video.c
+void simulate_scanvideo_pio_video_24mhz_composable(const uint32_t *dma_data, uint32_t dma_data_size,
+                                                   uint16_t *pixel_buffer, int32_t max_pixels, int32_t expected_width,
+                                                   bool overlay);
+int merge_dma_chain_variable(uint32_t *dma_chain, uint32_t dma_chain_size, uint32_t *out, int out_size);
+int merge_dma_chain_fixed(uint32_t *dma_chain, uint32_t dma_chain_size, uint32_t *out, int out_size,
+                          int fragment_words);
+uint32_t host_safe_hw_ptr_impl(uintptr_t x);
+extern SDL_sem *internal_vsync_sem;
+
+#define WIDTH 320
+#define MAX_LINE_WORDS 512
+#define FRAGMENT_WORDS 8
+#define MIN_SECONDS 0.25
+
+#define CMD(x) video_24mhz_composable_program_extern(x)
+
+enum pattern {
+    PATTERN_SOLID,   // a single color run
+    PATTERN_RAW,     // a single raw run
+    PATTERN_MIXED,   // alternating 16 pixel color and raw runs
+    PATTERN_OVERLAY, // alternating 32 pixel transparent and opaque color runs, for an overlay plane
+    PATTERN_EMPTY,   // nothing but the trailing black pixel; an unused overlay plane
+};
+
+static const char *const pattern_names[] = {"solid", "raw", "mixed", "overlay", "empty"};
+
+static uint16_t *color_run(uint16_t *p, uint16_t color, uint len) {
+    *p++ = CMD(color_run);
+    *p++ = color;
+    *p++ = (uint16_t) (len - 3);
+    return p;
+}
+
+static uint16_t *raw_run(uint16_t *p, uint x, uint len) {
+    *p++ = CMD(raw_run);
+    *p++ = (uint16_t) (x * 0x0841u + 1);
+    *p++ = (uint16_t) (len - 3);
+    for (uint i = 1; i < len; i++) {
+        *p++ = (uint16_t) ((x + i) * 0x0841u + 1);
+    }
+    return p;
+}
+
+// writes a composable scanline of the given pattern, width pixels wide, returning its length in words
+static uint build_scanline(uint32_t *out, enum pattern pattern, uint width) {
+    uint16_t *const start = (uint16_t *) out;
+    uint16_t *p = start;
+    switch (pattern) {
+        case PATTERN_SOLID:
+            p = color_run(p, 0x7fff, width);
+            break;
+        case PATTERN_RAW:
+            p = raw_run(p, 0, width);
+            break;
+        case PATTERN_MIXED:
+            for (uint x = 0; x < width; x += 16) {
+                p = (x & 16) ? raw_run(p, x, 16) : color_run(p, (uint16_t) (x + 1), 16);
+            }
+            break;
+        case PATTERN_OVERLAY:
+            for (uint x = 0; x < width; x += 32) {
+                p = color_run(p, (x & 32) ? (uint16_t) (0x1234 | PICO_SCANVIDEO_ALPHA_MASK) : 0, 32);
+            }
+            break;
+        case PATTERN_EMPTY:
+            break;
+    }
+    // scanlines end on a black pixel, padded to a whole word
+    *p++ = CMD(raw_1p);
+    *p++ = 0;
+    if ((p - start) & 1) {
+        *p++ = CMD(end_of_scanline_ALIGN);
+    } else {
+        *p++ = CMD(end_of_scanline_skip_ALIGN);
+        *p++ = 0;
+    }
+    return (uint) (p - start) / 2;
+}
+
+static void bench_decode(enum pattern pattern) {
+    static uint32_t line[MAX_LINE_WORDS];
+    static uint16_t pixels[WIDTH + 4];
+    uint words = build_scanline(line, pattern, WIDTH);
+    bool overlay = pattern == PATTERN_OVERLAY;
+    uint64_t count = 0;
+    double start = now_seconds(), elapsed;
+    do {
+        for (int r = 0; r < 256; r++) {
+            simulate_scanvideo_pio_video_24mhz_composable(line, words, pixels, count_of(pixels), WIDTH, overlay);
+        }
+        count += 256;
+        elapsed = now_seconds() - start;
+    } while (elapsed < MIN_SECONDS);
+    printf("decode         %-8s %9.1f Mpixels/s\n", pattern_names[pattern], count * WIDTH / elapsed / 1e6);
+}
+
+static void bench_merge(enum pattern pattern, bool fixed) {
+    static uint32_t line[MAX_LINE_WORDS];
+    static uint32_t chain[MAX_LINE_WORDS / FRAGMENT_WORDS * 2 + 2];
+    static uint32_t merged[MAX_LINE_WORDS];
+    uint words = build_scanline(line, pattern, WIDTH);
+    uint chain_words = 0;
+    for (uint pos = 0; pos < words; pos += FRAGMENT_WORDS) {
+        // fixed fragments run past the end of the scanline into the (zeroed) rest of the buffer
+        if (!fixed) chain[chain_words++] = MIN(FRAGMENT_WORDS, words - pos);
+        chain[chain_words++] = host_safe_hw_ptr_impl((uintptr_t) (line + pos));
+    }
+    if (!fixed) chain[chain_words++] = 0;
+    chain[chain_words++] = 0;
+    uint64_t count = 0;
+    double start = now_seconds(), elapsed;
+    do {
+        for (int r = 0; r < 256; r++) {
+            if (fixed) {
+                merge_dma_chain_fixed(chain, chain_words, merged, count_of(merged), FRAGMENT_WORDS);
+            } else {
+                merge_dma_chain_variable(chain, chain_words, merged, count_of(merged));
+            }
+        }
+        count += 256;
+        elapsed = now_seconds() - start;
+    } while (elapsed < MIN_SECONDS);
+    printf("%-14s %-8s %9.1f Mpixels/s\n", fixed ? "merge_fixed" : "merge_variable", pattern_names[pattern],
+           count * WIDTH / elapsed / 1e6);
+}
+
+// whole frames through scanvideo_begin/end_scanline_generation, including the copy to the frame surface
+static void bench_frames(enum pattern pattern, enum pattern overlay_pattern) {
+    static uint32_t line[MAX_LINE_WORDS];
+    uint words = build_scanline(line, pattern, WIDTH);
+#if PICO_SCANVIDEO_PLANE_COUNT > 1
+    static uint32_t overlay_line[MAX_LINE_WORDS];
+    uint overlay_words = build_scanline(overlay_line, overlay_pattern, WIDTH);
+#endif
+    struct scanvideo_mode mode = scanvideo_get_mode();
+    uint64_t frames = 0;
+    double start = now_seconds(), elapsed;
+    do {
+        for (uint y = 0; y < mode.height; y++) {
+            if (!scanvideo_scanline_number(scanvideo_get_next_scanline_id())) SDL_SemPost(internal_vsync_sem);
+            struct scanvideo_scanline_buffer *buffer = scanvideo_begin_scanline_generation(true);
+            if (words > buffer->data_max) {
+                printf("frame          %-8s scanline too long for the buffer\n", pattern_names[pattern]);
+                return;
+            }
+            memcpy(buffer->data, line, words * sizeof(uint32_t));
+            buffer->data_used = (uint16_t) words;
+#if PICO_SCANVIDEO_PLANE_COUNT > 1
+            memcpy(buffer->data2, overlay_line, overlay_words * sizeof(uint32_t));
+            buffer->data2_used = (uint16_t) overlay_words;
+#endif
+            scanvideo_end_scanline_generation(buffer);
+        }
+        frames++;
+        elapsed = now_seconds() - start;
+    } while (elapsed < MIN_SECONDS);
+    printf("frame          %-8s %9.1f Mpixels/s %8.1f frames/s%s\n", pattern_names[pattern],
+           frames * mode.width * mode.height / elapsed / 1e6, frames / elapsed,
+           overlay_pattern == PATTERN_OVERLAY ? " (with overlay plane)" : "");
+}
+
+int main(void) {
+    for (enum pattern p = PATTERN_SOLID; p <= PATTERN_OVERLAY; p++) {
+        bench_decode(p);
+    }
+    for (enum pattern p = PATTERN_SOLID; p <= PATTERN_MIXED; p++) {
+        bench_merge(p, false);
+        bench_merge(p, true);
+    }
+    scanvideo_setup(&vga_mode_320x240_60);
+    for (enum pattern p = PATTERN_SOLID; p <= PATTERN_MIXED; p++) {
+        bench_frames(p, PATTERN_EMPTY);
+    }
+#if PICO_SCANVIDEO_PLANE_COUNT > 1
+    bench_frames(PATTERN_MIXED, PATTERN_OVERLAY);
+#endif
+    return 0;
+}
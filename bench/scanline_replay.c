@@ -0,0 +1,182 @@
+/*
+ * Copyright (c) 2020 Raspberry Pi (Trading) Ltd.
+ *
+ * SPDX-License-Identifier: BSD-3-Clause
+ */
+
+// Replays a scanline recording (see host_scanline_record.h) through scanvideo_begin/end_scanline_generation, without
+// the firmware that made it, reporting the decode rate at the end. Run as firmware on the simulated core 0:
+//
+//   PICO_HOST_SDL_REPLAY=<file>                   the recording to replay
+//   PICO_HOST_SDL_REPLAY_TIMING=original|max      submit scanlines at their recorded times, or as fast as possible
+//                                                 (the default); either way vsync is posted here as each frame starts
+//
+// set PICO_HOST_SDL_HEADLESS=1 as well to measure the decoder without presenting frames
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "pico.h"
+#include "pico/scanvideo.h"
+#include "pico/scanvideo/composable_scanline.h"
+#include "pico/host_scanline_record.h"
+#include "SDL.h"
+#include "bench_common.h"
+
+// sdl_video.c
+extern const struct scanvideo_pio_program video_24mhz_composable;
+extern SDL_sem *internal_vsync_sem;
+
+static struct scanvideo_timing replay_timing;
+static struct scanvideo_mode replay_mode;
+static uint replay_repeat_count = 1;
+
+static uint replay_repeat_count_fn(uint32_t scanline_id) {
+    return replay_repeat_count;
+}
+
+static void setup_mode(const struct host_scanline_record_mode *mode) {
+    replay_timing = (struct scanvideo_timing) {
+            .clock_freq = mode->clock_freq,
+            .h_active = mode->h_active,
+            .v_active = mode->v_active,
+            .h_total = mode->h_total,
+            .v_total = mode->v_total,
+    };
+    replay_mode = (struct scanvideo_mode) {
+            .default_timing = &replay_timing,
+            .pio_program = &video_24mhz_composable,
+            .width = mode->width,
+            .height = mode->height,
+            .xscale = (uint8_t) mode->xscale,
+            .yscale = mode->yscale,
+            .yscale_denominator = mode->yscale_denominator,
+    };
+    scanvideo_setup_with_timing(&replay_mode, &replay_timing);
+    scanvideo_set_scanline_repeat_fn(replay_repeat_count_fn);
+}
+
+// a plane with nothing on it: a single black pixel
+static uint fill_empty(uint32_t *data) {
+    uint16_t *p = (uint16_t *) data;
+    *p++ = video_24mhz_composable_program_extern(raw_1p);
+    *p++ = 0;
+    *p++ = video_24mhz_composable_program_extern(end_of_scanline_skip_ALIGN);
+    *p++ = 0;
+    return 2;
+}
+
+static bool fill_plane(uint32_t *data, uint16_t *data_used, uint16_t data_max,
+                       const struct host_scanline_record_segment *segment, uint plane, uint plane_count) {
+    if (plane >= plane_count) {
+        *data_used = (uint16_t) fill_empty(data);
+        return true;
+    }
+    if (segment->word_count[plane] > data_max) return false;
+    memcpy(data, segment->words[plane], segment->word_count[plane] * sizeof(uint32_t));
+    *data_used = segment->word_count[plane];
+    return true;
+}
+
+static bool replay_scanline(const struct host_scanline_record *record) {
+    if (record->flags & PICO_HOST_SCANLINE_RECORD_TRUNCATED) {
+        printf("Error: recorded scanline %08x was truncated, so can't be replayed as the firmware submitted it\n",
+               (uint) record->scanline_id);
+        return false;
+    }
+    if (record->plane_count > PICO_SCANVIDEO_PLANE_COUNT) {
+        printf("Error: recording has %d planes, but replay was built with %d\n", record->plane_count,
+               PICO_SCANVIDEO_PLANE_COUNT);
+        return false;
+    }
+    uint segment_count = MAX(record->segment_count, 1);
+#if !PICO_SCANVIDEO_LINKED_SCANLINE_BUFFERS
+    if (segment_count > 1) {
+        printf("Error: recording has linked scanline buffers, but replay was built without them\n");
+        return false;
+    }
+#endif
+    struct scanvideo_scanline_buffer *buffer = scanvideo_begin_scanline_generation_linked(segment_count, true);
+    replay_repeat_count = record->repeat_count;
+    struct scanvideo_scanline_buffer *b = buffer;
+    for (uint s = 0; s < segment_count; s++) {
+        static const struct host_scanline_record_segment empty_segment;
+        const struct host_scanline_record_segment *segment = s < record->segment_count ? record->segments + s : &empty_segment;
+        uint plane_count = s < record->segment_count ? record->plane_count : 0;
+        bool ok = fill_plane(b->data, &b->data_used, b->data_max, segment, 0, plane_count);
+#if PICO_SCANVIDEO_PLANE_COUNT > 1
+        ok &= fill_plane(b->data2, &b->data2_used, b->data2_max, segment, 1, plane_count);
+#if PICO_SCANVIDEO_PLANE_COUNT > 2
+        ok &= fill_plane(b->data3, &b->data3_used, b->data3_max, segment, 2, plane_count);
+#endif
+#endif
+        if (!ok) {
+            printf("Error: recorded scanline %08x is too long for the scanline buffers\n", (uint) record->scanline_id);
+            return false;
+        }
+#if PICO_SCANVIDEO_LINKED_SCANLINE_BUFFERS
+        b->link_after = segment->rows;
+        b = b->link;
+#endif
+    }
+    scanvideo_end_scanline_generation(buffer);
+    return true;
+}
+
+int main(void) {
+    const char *path = getenv("PICO_HOST_SDL_REPLAY");
+    if (!path) {
+        printf("Error: set PICO_HOST_SDL_REPLAY to the recording to replay\n");
+        return 1;
+    }
+    const char *timing_env = getenv("PICO_HOST_SDL_REPLAY_TIMING");
+    bool original_timing = timing_env && !strcmp(timing_env, "original");
+    struct host_scanline_reader *reader = host_scanline_reader_open(path);
+    if (!reader) {
+        printf("Error: can't read scanline recording %s\n", path);
+        return 1;
+    }
+    static struct host_scanline_record_mode mode;
+    static struct host_scanline_record record;
+    bool have_mode = false;
+    uint64_t scanlines = 0, skipped = 0, pixels = 0, frames = 0;
+    double start = now_seconds(), due = 0;
+    uint type;
+    while ((type = host_scanline_reader_next(reader, &mode, &record))) {
+        if (type == PICO_HOST_SCANLINE_RECORD_MODE) {
+            setup_mode(&mode);
+            have_mode = true;
+            continue;
+        }
+        due += record.delta_us * 1e-6;
+        // a recording may begin part way through a frame, and the firmware may have dropped scanlines; either way
+        // wait for the scanline the decoder expects next
+        uint32_t next_scanline_id = scanvideo_get_next_scanline_id();
+        if (!have_mode || scanvideo_scanline_number(record.scanline_id) != scanvideo_scanline_number(next_scanline_id)) {
+            skipped++;
+            continue;
+        }
+        if (original_timing) {
+            double wait = start + due - now_seconds();
+            if (wait > 0) {
+                struct timespec ts = {.tv_sec = (time_t) wait, .tv_nsec = (long) ((wait - (time_t) wait) * 1e9)};
+                nanosleep(&ts, NULL);
+            }
+        }
+        // the vsync timer isn't running, so stand in for it; with original timing the wait above paces the frames
+        if (!scanvideo_scanline_number(next_scanline_id)) {
+            SDL_SemPost(internal_vsync_sem);
+            frames++;
+        }
+        if (!replay_scanline(&record)) break;
+        scanlines++;
+        pixels += (uint64_t) mode.width * MAX(record.repeat_count, 1);
+    }
+    double elapsed = now_seconds() - start;
+    host_scanline_reader_close(reader);
+    printf("replayed %llu scanlines (%llu skipped), %llu frames in %.3f s: %.1f frames/s %.1f Mpixels/s\n",
+           (unsigned long long) scanlines, (unsigned long long) skipped, (unsigned long long) frames, elapsed,
+           frames / elapsed, pixels / elapsed / 1e6);
+    return 0;
+}
@@ -0,0 +1,64 @@
+/*
+ * Copyright (c) 2020 Raspberry Pi (Trading) Ltd.
+ *
+ * SPDX-License-Identifier: BSD-3-Clause
+ */
+
+#ifndef _PICO_HOST_AUDIO_H
+#define _PICO_HOST_AUDIO_H
+
+#include "pico.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Output gain (clamped to [0, 8)) applied to the connected producer; the default may also be set at startup via
+// the PICO_HOST_SDL_AUDIO_GAIN environment variable
+void host_audio_set_gain(float gain);
+
+// Output buffering, for use before audio_pwm_setup/audio_i2s_setup. By default the device buffer is sized for the
+// max_latency_ms passed to audio_pwm_setup (or 50ms if none is given), split into 4 periods. These override that,
+// as do the PICO_HOST_SDL_AUDIO_LATENCY_MS, PICO_HOST_SDL_AUDIO_BUFFER_FRAMES and PICO_HOST_SDL_AUDIO_PERIOD_FRAMES
+// environment variables (which are used when the corresponding value here is left at 0 or -1)
+void host_audio_set_max_latency_ms(int32_t max_latency_ms);
+void host_audio_set_buffer_frames(uint buffer_frames, uint period_frames);
+
+// Whether small producer buffers are coalesced into period sized writes to the device (the default; ALSA only), for
+// use before setup. May also be set with the PICO_HOST_SDL_AUDIO_COALESCE environment variable set to 0 or 1
+void host_audio_set_coalesce_writes(bool coalesce);
+
+// Send audio to a file rather than the sound device (for machines without one), for use before setup. A path ending
+// in .wav gets a WAV header, anything else is written as raw interleaved S16 at the output rate. If paced, writing is
+// throttled to the sample rate by the host clock, otherwise it runs as fast as audio is produced. May also be
+// selected with the PICO_HOST_SDL_AUDIO_FILE and PICO_HOST_SDL_AUDIO_FILE_PACING environment variables
+void host_audio_set_output_file(const char *path, bool paced);
+
+// Measured output latency; the time until a sample given by the producer now would be heard
+uint32_t host_audio_get_latency_us(void);
+
+// Audio clock, suitable as a master clock: the duration of the frames the device has actually played since it was
+// opened (including any silence it played while starved), in microseconds. Returns false if no device is open
+bool host_audio_get_clock_us(uint64_t *us);
+
+// Counters accumulated since startup (or host_audio_reset_stats), answering whether the producer is keeping up
+struct host_audio_stats {
+    uint32_t underruns;         // times the output ran out of audio
+    uint32_t recoveries;        // times output restarted after an underrun
+    uint32_t buffers_written;   // producer buffers consumed
+    uint32_t device_writes;     // writes to the device (ALSA syscalls, SDL callbacks or file writes)
+    uint64_t producer_block_us; // total time producers spent blocked waiting for the output to make room
+    uint32_t queued_frames;     // output frames currently buffered
+    uint32_t latency_us;        // current latency, as host_audio_get_latency_us
+    uint32_t peak_latency_us;   // highest latency seen
+};
+
+// the stats may also be logged periodically by setting PICO_HOST_SDL_AUDIO_STATS_MS to the interval
+void host_audio_get_stats(struct host_audio_stats *stats);
+void host_audio_reset_stats(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif //_PICO_HOST_AUDIO_H
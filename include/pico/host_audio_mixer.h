@@ -0,0 +1,52 @@
+/*
+ * Copyright (c) 2020 Raspberry Pi (Trading) Ltd.
+ *
+ * SPDX-License-Identifier: BSD-3-Clause
+ */
+
+#ifndef _PICO_HOST_AUDIO_MIXER_H
+#define _PICO_HOST_AUDIO_MIXER_H
+
+#include "pico.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Mixes any number of streams of interleaved S16 frames (all with the mixer's channel count and rate) into one.
+// Each stream is a single producer / single consumer ring, so a producer that gets ahead is only ever blocked by
+// its own ring filling up, and never by another stream. There is a single consumer (the device) for all streams.
+struct host_audio_mixer;
+struct host_audio_mixer_stream;
+
+struct host_audio_mixer *host_audio_mixer_create(uint channel_count, uint max_streams);
+
+// Streams are never removed. Adding a stream may race with the consumer, but not with adding another stream.
+// Returns NULL if max_streams have already been added
+struct host_audio_mixer_stream *host_audio_mixer_add_stream(struct host_audio_mixer *mixer, uint ring_frames);
+
+// Producer side: returns the next contiguous run of free frames in the stream's ring (setting *frames to its
+// length), or NULL if the ring is full. host_audio_mixer_stream_wait blocks until the consumer frees some space
+int16_t *host_audio_mixer_stream_space(struct host_audio_mixer_stream *stream, uint *frames);
+void host_audio_mixer_stream_commit(struct host_audio_mixer_stream *stream, uint frames);
+void host_audio_mixer_stream_wait(struct host_audio_mixer_stream *stream);
+
+// Consumer side: the number of frames every stream can supply, and the most any single stream can
+uint host_audio_mixer_ready(struct host_audio_mixer *mixer);
+uint host_audio_mixer_queued(struct host_audio_mixer *mixer);
+
+// Mixes up to frames frames from each stream into out, padding streams that run short (and the output) with
+// silence. Returns the number of frames for which any stream had data
+uint host_audio_mixer_mix(struct host_audio_mixer *mixer, int16_t *out, uint frames);
+
+// Blocks until a producer commits some frames, or for timeout_ms; returns false on timeout
+bool host_audio_mixer_wait(struct host_audio_mixer *mixer, uint timeout_ms);
+
+// dst[i] = saturate(dst[i] + src[i])
+void host_audio_mix_s16(int16_t *dst, const int16_t *src, uint samples);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif //_PICO_HOST_AUDIO_MIXER_H
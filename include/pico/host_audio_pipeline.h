@@ -0,0 +1,60 @@
+/*
+ * Copyright (c) 2020 Raspberry Pi (Trading) Ltd.
+ *
+ * SPDX-License-Identifier: BSD-3-Clause
+ */
+
+#ifndef _PICO_HOST_AUDIO_PIPELINE_H
+#define _PICO_HOST_AUDIO_PIPELINE_H
+
+#include "pico.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+enum host_audio_sample_format {
+    HOST_AUDIO_SAMPLE_S8,
+    HOST_AUDIO_SAMPLE_U8,
+    HOST_AUDIO_SAMPLE_S16,
+    HOST_AUDIO_SAMPLE_U16,
+    HOST_AUDIO_SAMPLE_S32,
+    HOST_AUDIO_SAMPLE_F32, // full scale is +/-1.0
+};
+
+struct host_audio_pipeline_config {
+    enum host_audio_sample_format input_format;
+    uint input_channels;
+    uint input_rate;
+    // output is always interleaved S16
+    uint output_channels;
+    uint output_rate;
+};
+
+// Converts a stream of interleaved input frames to the output format through a fixed sequence of stages, each
+// specialized when the pipeline is created and skipped entirely when not needed:
+//
+// widen (to S16) -> channel map (same count, mono to stereo, or stereo to mono) -> resample -> gain
+//
+// Input is processed in fixed size chunks, so buffers of any length may be passed. Returns NULL if the channel
+// mapping isn't supported
+struct host_audio_pipeline *host_audio_pipeline_create(const struct host_audio_pipeline_config *config);
+void host_audio_pipeline_destroy(struct host_audio_pipeline *pipeline);
+
+// gain is clamped to [0, 8); the gain stage is skipped at unity
+void host_audio_pipeline_set_gain(struct host_audio_pipeline *pipeline, float gain);
+
+// true if the output is just a copy of the input
+bool host_audio_pipeline_is_passthrough(struct host_audio_pipeline *pipeline);
+
+// Converts from in into out, stopping once all input_frames have been consumed and no further output can be
+// produced from them, or once output_frames have been written. Returns the number of frames written to out, and
+// sets *input_frames_used to the number of frames consumed from in (the remainder should be passed to the next call)
+uint host_audio_pipeline_process(struct host_audio_pipeline *pipeline, const void *in, uint input_frames,
+                                 uint *input_frames_used, int16_t *out, uint output_frames);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif //_PICO_HOST_AUDIO_PIPELINE_H
@@ -0,0 +1,57 @@
+/*
+ * Copyright (c) 2020 Raspberry Pi (Trading) Ltd.
+ *
+ * SPDX-License-Identifier: BSD-3-Clause
+ */
+
+#ifndef _PICO_HOST_CORE_TIME_H
+#define _PICO_HOST_CORE_TIME_H
+
+#include "pico.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Where each simulated core's time goes: the wall clock and thread CPU time spent in each blocking primitive, with
+// the rest counted as busy. This gives a (host side) estimate of how loaded each core of a firmware design is.
+// A wait nested inside another (e.g. the __wfe inside a semaphore wait) is counted as the outer one, and a wait is
+// only counted once it has finished. Thread CPU time is only available on Linux; elsewhere cpu_us is all zeroes.
+//
+// A summary may also be logged periodically by setting PICO_HOST_SDL_CORE_TIME_MS to the interval
+enum host_core_time_state {
+    HOST_CORE_TIME_BUSY,
+    HOST_CORE_TIME_WFE,           // __wfe
+    HOST_CORE_TIME_TIGHT_LOOP,    // tight_loop_contents
+    HOST_CORE_TIME_SEMAPHORE,     // waiting for the vsync, or on the scanvideo vblank/hblank semaphores
+    HOST_CORE_TIME_SPIN_LOCK,     // waiting for a spin lock held by another core
+    HOST_CORE_TIME_AUDIO_BLOCKED, // giving an audio buffer while the producer's stream is full
+    HOST_CORE_TIME_STATE_COUNT
+};
+
+struct host_core_time {
+    bool running;
+    // since the core started (or host_core_time_reset), indexed by state
+    uint64_t wall_us[HOST_CORE_TIME_STATE_COUNT];
+    uint64_t cpu_us[HOST_CORE_TIME_STATE_COUNT];
+};
+
+void host_core_time_get(uint core, struct host_core_time *time);
+void host_core_time_reset(void);
+
+// log the changes every interval_ms on the SDL timer thread
+void host_core_time_start_log(uint32_t interval_ms);
+
+// Called by a core's thread as it starts; other threads aren't accounted
+void host_core_time_thread_start(uint core);
+
+// Bracket a blocking call on a core's thread: host_core_time_leave(host_core_time_enter(state)). A no-op on other
+// threads, and for nested waits
+enum host_core_time_state host_core_time_enter(enum host_core_time_state state);
+void host_core_time_leave(enum host_core_time_state previous);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif //_PICO_HOST_CORE_TIME_H
@@ -0,0 +1,54 @@
+/*
+ * Copyright (c) 2020 Raspberry Pi (Trading) Ltd.
+ *
+ * SPDX-License-Identifier: BSD-3-Clause
+ */
+
+#ifndef _PICO_HOST_FRAME_STREAM_H
+#define _PICO_HOST_FRAME_STREAM_H
+
+#include "pico.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Optional server which streams completed frames to any number of viewers over a local socket.
+//
+// The address is either "unix:<path>" or "tcp:<port>" (which is bound to the loopback interface only). The server
+// is also started at startup if the PICO_HOST_SDL_FRAME_STREAM environment variable is set to such an address.
+//
+// Each client receives a sequence of messages; all values are little endian:
+//
+//   header:  uint32_t magic (PICO_HOST_FRAME_STREAM_MAGIC)
+//            uint8_t  type (PICO_HOST_FRAME_STREAM_KEY_FRAME or PICO_HOST_FRAME_STREAM_DELTA_FRAME)
+//            uint8_t  reserved
+//            uint16_t width
+//            uint16_t height
+//            uint16_t row_count
+//            uint32_t frame_number
+//            uint32_t payload_bytes
+//   payload: row_count rows of
+//            uint16_t y
+//            uint16_t run_count
+//            run_count runs of { uint16_t length, uint16_t rgb565 }
+//
+// A key frame contains every row. A delta frame contains only the rows which differ from the previous frame sent
+// to that client. Clients which can't keep up have frames dropped, and are sent a key frame once they catch up.
+// frame_stream_client in bench is a viewer which decodes and checks this format.
+#define PICO_HOST_FRAME_STREAM_MAGIC 0x31534650u // "PFS1"
+#define PICO_HOST_FRAME_STREAM_KEY_FRAME 0u
+#define PICO_HOST_FRAME_STREAM_DELTA_FRAME 1u
+
+bool frame_stream_start(const char *address);
+
+uint frame_stream_get_client_count(void);
+
+// called by the video code once per completed frame
+void frame_stream_submit_frame(const uint16_t *pixels, uint pitch, uint width, uint height, uint32_t frame_number);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif //_PICO_HOST_FRAME_STREAM_H
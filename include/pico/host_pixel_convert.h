@@ -0,0 +1,35 @@
+/*
+ * Copyright (c) 2020 Raspberry Pi (Trading) Ltd.
+ *
+ * SPDX-License-Identifier: BSD-3-Clause
+ */
+
+#ifndef _PICO_HOST_PIXEL_CONVERT_H
+#define _PICO_HOST_PIXEL_CONVERT_H
+
+#include "pico.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Formats scanvideo pixels (as laid out by PICO_SCANVIDEO_PIXEL_RSHIFT/GSHIFT/BSHIFT and the matching counts) can
+// be converted to for presentation. The 32 bit formats are named by their byte order in memory, and have the
+// unused byte set to 0xff.
+enum host_pixel_format {
+    HOST_PIXEL_FORMAT_BGRX8888, // SDL_PIXELFORMAT_ARGB8888 / SDL_PIXELFORMAT_RGB888 on little endian hosts
+    HOST_PIXEL_FORMAT_RGBX8888, // SDL_PIXELFORMAT_ABGR8888 / SDL_PIXELFORMAT_BGR888 on little endian hosts
+    HOST_PIXEL_FORMAT_RGB565,   // SDL_PIXELFORMAT_RGB565
+};
+
+typedef void (*host_pixel_convert_fn)(const uint16_t *src, void *dst, uint count);
+
+host_pixel_convert_fn host_pixel_convert_get(enum host_pixel_format format);
+
+uint host_pixel_format_bytes_per_pixel(enum host_pixel_format format);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif //_PICO_HOST_PIXEL_CONVERT_H
@@ -0,0 +1,36 @@
+/*
+ * Copyright (c) 2020 Raspberry Pi (Trading) Ltd.
+ *
+ * SPDX-License-Identifier: BSD-3-Clause
+ */
+
+#ifndef _PICO_HOST_RESAMPLER_H
+#define _PICO_HOST_RESAMPLER_H
+
+#include "pico.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Polyphase windowed-sinc sample rate converter for interleaved frames, handling any input/output rate pair. The
+// resampler keeps its filter history between calls, so a stream may be fed in buffers of any size, and introduces
+// a fixed delay of half the filter length.
+struct host_resampler;
+
+struct host_resampler *host_resampler_create(uint input_rate, uint output_rate, uint channel_count);
+void host_resampler_destroy(struct host_resampler *resampler);
+
+// Resample from in into out, stopping once all input_frames have been consumed and no further output can be
+// produced from them, or once output_frames have been written. Returns the number of frames written to out, and
+// sets *input_frames_used to the number of frames consumed from in (the remainder should be passed to the next call)
+uint host_resampler_process_s16(struct host_resampler *resampler, const int16_t *in, uint input_frames,
+                                uint *input_frames_used, int16_t *out, uint output_frames);
+uint host_resampler_process_s8(struct host_resampler *resampler, const int8_t *in, uint input_frames,
+                               uint *input_frames_used, int16_t *out, uint output_frames);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif //_PICO_HOST_RESAMPLER_H
@@ -0,0 +1,36 @@
+/*
+ * Copyright (c) 2020 Raspberry Pi (Trading) Ltd.
+ *
+ * SPDX-License-Identifier: BSD-3-Clause
+ */
+
+#ifndef _PICO_HOST_SCALER_H
+#define _PICO_HOST_SCALER_H
+
+#include "pico.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// CPU scaler used to present the frame when the renderer can't do a smoothed upscale itself (i.e. no
+// target texture support, or the software renderer). It may also be selected at startup via the
+// PICO_HOST_SDL_SCALER environment variable set to "nearest", "bilinear" or "scale2x".
+enum host_scaler_filter {
+    HOST_SCALER_NEAREST,
+    HOST_SCALER_BILINEAR,
+    HOST_SCALER_SCALE2X,
+};
+
+void host_scaler_set_filter(enum host_scaler_filter filter);
+enum host_scaler_filter host_scaler_get_filter(void);
+
+// scale a 16 bit 5:6:5 image (in either channel order); pitches are in bytes
+void host_scaler_scale(const uint16_t *src, uint src_pitch, uint src_width, uint src_height,
+                       uint16_t *dst, uint dst_pitch, uint dst_width, uint dst_height);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif //_PICO_HOST_SCALER_H
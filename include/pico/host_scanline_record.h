@@ -0,0 +1,100 @@
+/*
+ * Copyright (c) 2020 Raspberry Pi (Trading) Ltd.
+ *
+ * SPDX-License-Identifier: BSD-3-Clause
+ */
+
+#ifndef _PICO_HOST_SCANLINE_RECORD_H
+#define _PICO_HOST_SCANLINE_RECORD_H
+
+#include "pico.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Recordings of every scanline buffer submitted to scanvideo_end_scanline_generation, with fragmented DMA chains
+// already merged, so they can be replayed through the decoder without the firmware (see scanline_replay in bench).
+//
+// Recording is started with host_video_record_scanlines, or at startup by setting the PICO_HOST_SDL_SCANLINE_RECORD
+// environment variable to the file to write. The file is a header followed by records; all values are little endian:
+//
+//   header:   uint32_t magic (PICO_HOST_SCANLINE_RECORD_MAGIC)
+//             uint16_t version (PICO_HOST_SCANLINE_RECORD_VERSION)
+//             uint16_t reserved
+//   record:   uint8_t  type (PICO_HOST_SCANLINE_RECORD_MODE or PICO_HOST_SCANLINE_RECORD_SCANLINE)
+//   mode:     uint16_t width, height, xscale, yscale, yscale_denominator
+//             uint32_t clock_freq
+//             uint16_t h_active, v_active, h_total, v_total
+//   scanline: uint32_t scanline_id
+//             uint32_t delta_us (since the previous scanline was submitted)
+//             uint16_t repeat_count (as returned by the scanline repeat count function)
+//             uint8_t  plane_count
+//             uint8_t  segment_count
+//             uint8_t  flags (PICO_HOST_SCANLINE_RECORD_TRUNCATED)
+//             segment_count segments of
+//               uint16_t rows (decoded from this segment before moving on to the next linked buffer; 0 for all)
+//               plane_count planes of { uint16_t word_count, uint32_t words[word_count] }
+//
+// A mode record precedes the first scanline, and is repeated whenever the video mode is set up again. A scanline
+// with more linked buffers than PICO_HOST_SCANLINE_RECORD_MAX_SEGMENTS, or a plane longer than
+// PICO_HOST_SCANLINE_RECORD_MAX_WORDS, can't be recorded in full; it is marked truncated, and replay refuses it.
+#define PICO_HOST_SCANLINE_RECORD_MAGIC 0x524c5350u // "PSLR"
+#define PICO_HOST_SCANLINE_RECORD_VERSION 2u
+#define PICO_HOST_SCANLINE_RECORD_MODE 1u
+#define PICO_HOST_SCANLINE_RECORD_SCANLINE 2u
+
+#define PICO_HOST_SCANLINE_RECORD_TRUNCATED 1u
+
+#define PICO_HOST_SCANLINE_RECORD_MAX_PLANES 3
+#define PICO_HOST_SCANLINE_RECORD_MAX_SEGMENTS 8
+#define PICO_HOST_SCANLINE_RECORD_MAX_WORDS 1024
+
+struct host_scanline_record_mode {
+    uint16_t width, height, xscale, yscale, yscale_denominator;
+    uint32_t clock_freq;
+    uint16_t h_active, v_active, h_total, v_total;
+};
+
+struct host_scanline_record_segment {
+    uint16_t rows;
+    uint16_t word_count[PICO_HOST_SCANLINE_RECORD_MAX_PLANES];
+    const uint32_t *words[PICO_HOST_SCANLINE_RECORD_MAX_PLANES];
+};
+
+struct host_scanline_record {
+    uint32_t scanline_id;
+    uint32_t delta_us;
+    uint16_t repeat_count;
+    uint8_t plane_count;
+    uint8_t segment_count;
+    uint8_t flags;
+    struct host_scanline_record_segment segments[PICO_HOST_SCANLINE_RECORD_MAX_SEGMENTS];
+};
+
+// Start recording to path (replacing any recording in progress), or stop if path is NULL
+bool host_video_record_scanlines(const char *path);
+
+struct host_scanline_writer;
+
+struct host_scanline_writer *host_scanline_writer_open(const char *path);
+bool host_scanline_writer_write_mode(struct host_scanline_writer *writer, const struct host_scanline_record_mode *mode);
+bool host_scanline_writer_write_scanline(struct host_scanline_writer *writer, const struct host_scanline_record *record);
+void host_scanline_writer_close(struct host_scanline_writer *writer);
+
+struct host_scanline_reader;
+
+// returns NULL if the file can't be opened or isn't a recording
+struct host_scanline_reader *host_scanline_reader_open(const char *path);
+
+// Reads the next record, returning its type (filling in *mode or *record accordingly), or 0 at the end of the
+// file or on error. The record's words remain valid until the next call
+uint host_scanline_reader_next(struct host_scanline_reader *reader, struct host_scanline_record_mode *mode,
+                               struct host_scanline_record *record);
+void host_scanline_reader_close(struct host_scanline_reader *reader);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif //_PICO_HOST_SCANLINE_RECORD_H
@@ -0,0 +1,42 @@
+/*
+ * Copyright (c) 2020 Raspberry Pi (Trading) Ltd.
+ *
+ * SPDX-License-Identifier: BSD-3-Clause
+ */
+
+#ifndef _PICO_HOST_SPIN_LOCK_H
+#define _PICO_HOST_SPIN_LOCK_H
+
+#include "pico.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// The simulated spin locks are fair (ticket) locks. When built with PICO_HOST_SPIN_LOCK_STATS=1, each keeps counters
+// of how it is used, to find which lock (e.g. a pico_sync striped lock, or the timer lock used by alarm pools) the
+// cores are fighting over. The counters are reported on exit, per lock number, if PICO_HOST_SDL_SPIN_LOCK_STATS is
+// set to 1. They are off by default, as they add clock reads and atomic updates to every lock and unlock
+#ifndef PICO_HOST_SPIN_LOCK_STATS
+#define PICO_HOST_SPIN_LOCK_STATS 0
+#endif
+
+struct host_spin_lock_stats {
+    uint64_t acquisitions;
+    uint64_t contended;     // acquisitions which found the lock held
+    uint64_t spins;         // backoff rounds spent waiting in contended acquisitions
+    uint32_t max_hold_us;   // longest the lock has been held
+};
+
+// all zeroes without PICO_HOST_SPIN_LOCK_STATS
+void host_spin_lock_get_stats(uint lock_num, struct host_spin_lock_stats *stats);
+void host_spin_lock_reset_stats(void);
+
+// prints the counters of every lock that has been used
+void host_spin_lock_print_stats(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif //_PICO_HOST_SPIN_LOCK_H
@@ -0,0 +1,80 @@
+/*
+ * Copyright (c) 2020 Raspberry Pi (Trading) Ltd.
+ *
+ * SPDX-License-Identifier: BSD-3-Clause
+ */
+
+#ifndef _PICO_HOST_THREAD_H
+#define _PICO_HOST_THREAD_H
+
+#include "pico.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Which host thread is running, held in a compiler native thread local so hot paths (get_core_num, __wfe and
+// scanline generation) don't go through SDL's TLS. Each thread identifies itself as it starts (or, for SDL's timer
+// and audio callback threads, on each callback); anything else is HOST_THREAD_OTHER.
+//
+// The simulated cores are the only threads with a core of their own. get_core_num() still returns 0 on other
+// threads (timer callbacks stand in for core 0's IRQs), but per core state such as __wfe's event flags is kept
+// separately for them
+enum host_thread_id {
+    HOST_THREAD_CORE0,
+    HOST_THREAD_CORE1,
+    HOST_THREAD_MAIN,   // the SDL main (event and render) thread
+    HOST_THREAD_TIMER,  // SDL timer callbacks (vsync and alarms)
+    HOST_THREAD_AUDIO,  // the ALSA writer or SDL audio callback
+    HOST_THREAD_OTHER,
+    HOST_THREAD_COUNT
+};
+
+#ifdef __cplusplus
+extern thread_local uint8_t host_thread_current;
+#else
+extern _Thread_local uint8_t host_thread_current;
+#endif
+
+static inline enum host_thread_id host_thread_id(void) {
+    return (enum host_thread_id) host_thread_current;
+}
+
+static inline bool host_thread_is_core(void) {
+    return host_thread_current < NUM_CORES;
+}
+
+// Called by a thread to identify itself; also names it in traces, and starts a core's time accounting
+void host_thread_set_id(enum host_thread_id id);
+
+const char *host_thread_name(enum host_thread_id id);
+
+// Host CPU placement and scheduling of a thread, applied when it identifies itself (or at once, if it already has).
+// The defaults may also be set at startup with environment variables holding space separated <thread>=<value>
+// entries, where <thread> is core0, core1, main, timer or audio:
+//
+//   PICO_HOST_SDL_AFFINITY   CPU lists, e.g. "core0=2 core1=3 main=0 timer=1 audio=1" or "main=0,4-5"
+//   PICO_HOST_SDL_SCHED      fifo or rr with an optional priority, e.g. "core0=fifo:10 core1=fifo:10 audio=rr:20"
+//
+// Real time scheduling needs permission (e.g. CAP_SYS_NICE, or an rtprio limit on Linux); when it is refused, the
+// thread keeps running under the default policy. CPU affinity is only supported on Linux
+enum host_thread_sched {
+    HOST_THREAD_SCHED_DEFAULT, // leave the policy as it is
+    HOST_THREAD_SCHED_FIFO,
+    HOST_THREAD_SCHED_RR,
+};
+
+struct host_thread_config {
+    uint64_t cpus;                 // host CPUs the thread may run on, one bit each; 0 leaves it to the OS
+    enum host_thread_sched sched;
+    int priority;                  // for FIFO and RR; 0 picks the lowest
+};
+
+void host_thread_set_config(enum host_thread_id id, const struct host_thread_config *config);
+void host_thread_get_config(enum host_thread_id id, struct host_thread_config *config);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif //_PICO_HOST_THREAD_H
@@ -0,0 +1,81 @@
+/*
+ * Copyright (c) 2020 Raspberry Pi (Trading) Ltd.
+ *
+ * SPDX-License-Identifier: BSD-3-Clause
+ */
+
+#ifndef _PICO_HOST_TRACE_H
+#define _PICO_HOST_TRACE_H
+
+#include "pico.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Timestamped events from the simulated cores, the SDL main and timer threads and the audio writer, for seeing how
+// they interleave. Each thread records into its own ring (of the last PICO_HOST_TRACE_RING_EVENTS events) without
+// locking, and the rings are written out in Chrome trace event format, which chrome://tracing and Perfetto load.
+//
+// Tracing is started at startup by setting the PICO_HOST_SDL_TRACE environment variable to the file to write; the
+// trace is then written on exit, and whenever Alt+T is pressed. When tracing is off, recording an event costs a
+// test of host_trace_enabled, and defining PICO_HOST_TRACE to 0 compiles the events out entirely
+#ifndef PICO_HOST_TRACE
+#define PICO_HOST_TRACE 1
+#endif
+
+// per thread; must be a power of 2
+#ifndef PICO_HOST_TRACE_RING_EVENTS
+#define PICO_HOST_TRACE_RING_EVENTS 65536
+#endif
+
+enum host_trace_event {
+    HOST_TRACE_SCANLINE,    // from scanvideo_begin_scanline_generation to end; arg is the scanline id
+    HOST_TRACE_VBLANK,      // the vsync timer firing
+    HOST_TRACE_WFE,         // blocked in __wfe
+    HOST_TRACE_SPIN_LOCK,   // a spin lock held; arg is the lock number
+    HOST_TRACE_ALARM,       // an alarm callback; arg is the alarm number
+    HOST_TRACE_AUDIO_GIVE,  // a producer giving an audio buffer, including any wait for room; arg is its sample count
+    HOST_TRACE_AUDIO_WRITE, // mixing into the audio device (or file); arg is the frames asked for
+    HOST_TRACE_SD_SECTOR,   // an SD card sector read completing; arg is the sector
+    HOST_TRACE_EVENT_COUNT
+};
+
+extern volatile bool host_trace_enabled;
+
+void host_trace_record(enum host_trace_event event, char phase, uint32_t arg);
+
+static inline void host_trace_begin(enum host_trace_event event, uint32_t arg) {
+#if PICO_HOST_TRACE
+    if (host_trace_enabled) host_trace_record(event, 'B', arg);
+#endif
+}
+
+static inline void host_trace_end(enum host_trace_event event, uint32_t arg) {
+#if PICO_HOST_TRACE
+    if (host_trace_enabled) host_trace_record(event, 'E', arg);
+#endif
+}
+
+static inline void host_trace_instant(enum host_trace_event event, uint32_t arg) {
+#if PICO_HOST_TRACE
+    if (host_trace_enabled) host_trace_record(event, 'i', arg);
+#endif
+}
+
+// Names the calling thread in the trace; name must remain valid (e.g. a string literal). Threads that aren't named
+// (host_thread_set_id does so) appear by their SDL thread id
+void host_trace_set_thread_name(const char *name);
+
+// Start tracing, to be written to path by host_trace_dump (and on exit); the rings are cleared
+bool host_trace_start(const char *path);
+void host_trace_stop(void);
+
+// Writes the events currently in the rings to the path given to host_trace_start; tracing carries on
+bool host_trace_dump(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif //_PICO_HOST_TRACE_H
@@ -0,0 +1,78 @@
+/*
+ * Copyright (c) 2020 Raspberry Pi (Trading) Ltd.
+ *
+ * SPDX-License-Identifier: BSD-3-Clause
+ */
+
+#ifndef _PICO_HOST_VIDEO_H
+#define _PICO_HOST_VIDEO_H
+
+#include "pico.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// How completed frames are handed to the (SDL main thread) presenter. The default may also be chosen at startup
+// via the PICO_HOST_SDL_FRAME_PACING environment variable set to "latest", "refresh" or "every".
+enum host_frame_pacing {
+    // at most one present is outstanding; frames completed meanwhile are dropped in favor of the latest
+    HOST_FRAME_PACING_LATEST,
+    // as HOST_FRAME_PACING_LATEST, but additionally never present faster than the display refresh rate
+    HOST_FRAME_PACING_REFRESH,
+    // present every frame; latency grows without bound if the presenter can't keep up
+    HOST_FRAME_PACING_EVERY,
+};
+
+#ifndef PICO_HOST_SDL_DEFAULT_FRAME_PACING
+#define PICO_HOST_SDL_DEFAULT_FRAME_PACING HOST_FRAME_PACING_LATEST
+#endif
+
+struct host_frame_stats {
+    uint64_t produced;
+    uint64_t presented;
+    uint64_t dropped;
+};
+
+void host_video_set_frame_pacing(enum host_frame_pacing pacing);
+enum host_frame_pacing host_video_get_frame_pacing(void);
+
+void host_video_get_frame_stats(struct host_frame_stats *stats);
+
+// Set by the audio backend; returns how full its output queue is (0 to 1) for the performance overlay (Alt+H)
+extern float (*host_video_audio_queue_fill_fn)(void);
+
+// A/V sync against the audio device's clock (host_audio_get_clock_us). Video time is the count of vsyncs since the
+// clocks were aligned (at the first vsync with audio playing) at the mode's nominal refresh rate. The default may
+// also be chosen at startup via the PICO_HOST_SDL_AV_SYNC environment variable set to "off", "measure" or
+// "follow", in which case the measurements are also logged once a second
+enum host_av_sync {
+    HOST_AV_SYNC_OFF,
+    // compare video time with the audio clock
+    HOST_AV_SYNC_MEASURE,
+    // as HOST_AV_SYNC_MEASURE, but also slew the vsync generator so video follows the audio clock
+    HOST_AV_SYNC_FOLLOW_AUDIO,
+};
+
+struct host_av_sync_stats {
+    int64_t offset_us;      // video time minus audio time; positive when video is ahead
+    int64_t max_offset_us;  // offset_us of the largest magnitude seen
+    double drift_ppm;       // how much faster video ran than audio over the last second, in parts per million
+    double slew_ppm;        // change currently applied to the vsync period when following audio
+    uint32_t seconds;       // seconds of audio measured over
+};
+
+void host_video_set_av_sync(enum host_av_sync mode);
+enum host_av_sync host_video_get_av_sync(void);
+
+// returns false if the clocks haven't been aligned yet
+bool host_video_get_av_sync_stats(struct host_av_sync_stats *stats);
+
+// Set by the audio backend to host_audio_get_clock_us
+extern bool (*host_video_audio_clock_fn)(uint64_t *us);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif //_PICO_HOST_VIDEO_H
@@ -43,10 +43,18 @@ extern void (*platform_mouse_button_down)(int button);
 extern void (*platform_mouse_button_up)(int button);
 extern void (*platform_quit)();
 
+#ifndef PICO_SCANVIDEO_ALPHA_PIN
 #define PICO_SCANVIDEO_ALPHA_PIN 5u
+#endif
+#ifndef PICO_SCANVIDEO_PIXEL_RSHIFT
 #define PICO_SCANVIDEO_PIXEL_RSHIFT 0u
+#endif
+#ifndef PICO_SCANVIDEO_PIXEL_GSHIFT
 #define PICO_SCANVIDEO_PIXEL_GSHIFT 6u
+#endif
+#ifndef PICO_SCANVIDEO_PIXEL_BSHIFT
 #define PICO_SCANVIDEO_PIXEL_BSHIFT 11u
+#endif
 
 #endif
 #endif
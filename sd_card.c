@@ -7,6 +7,7 @@
 #if PICO_EXTRAS
 #include <stdio.h>
 #include "pico/sd_card.h"
+#include "pico/host_trace.h"
 #include "SDL_timer.h"
 
 static FILE *sd_file_in;
@@ -86,6 +87,7 @@ bool sd_scatter_read_complete(int *status) {
         assert(ptr);
         assert(sd_next_control_word[1] == 2);
         sd_next_control_word += 2; // skip CRC
+        host_trace_instant(HOST_TRACE_SD_SECTOR, sd_sector);
         sd_sector++;
         sd_read_sector_count--;
         sector_next_tick_ms += sector_ms;
@@ -4,6 +4,8 @@
  * SPDX-License-Identifier: BSD-3-Clause
  */
 
+#include <strings.h>
+
 #include "pico.h"
 #include "pico/audio.h"
 #include "pico/multicore.h"
@@ -12,6 +14,16 @@
 #include "hardware/sync.h"
 #include "pico/audio_i2s.h"
 #include "pico/audio_pwm.h"
+#include "pico/host_audio.h"
+#include "pico/host_audio_mixer.h"
+#include "pico/host_audio_pipeline.h"
+#include "pico/host_core_time.h"
+#include "pico/host_thread.h"
+#include "pico/host_trace.h"
+#include "pico/host_video.h"
+#include "sdl_le.h"
+#include "SDL.h"
+#include <stdatomic.h>
 
 #ifdef NATIVE_AUDIO_ALSA
 #  include <alsa/asoundlib.h>
@@ -24,20 +36,210 @@ const struct audio_pwm_channel_config default_left_channel_config;
 const struct audio_pwm_channel_config default_right_channel_config;
 const struct audio_pwm_channel_config default_mono_channel_config;
 
-const struct audio_format *native_audio_setup(const struct audio_format *intended_audio_format);
+const struct audio_format *native_audio_setup(const struct audio_format *intended_audio_format, int32_t max_latency_ms);
 void native_audio_enable(bool enable);
 bool native_audio_connect(struct audio_buffer_pool *producer_pool);
+static uint32_t native_audio_get_latency_us(void);
+static uint64_t native_audio_get_played_frames(void);
+static uint32_t native_audio_get_period_frames(void);
 
 static struct audio_format consumer_format;
 static struct audio_buffer_format consumer_buffer_format = {
     .format = &consumer_format
 };
 
+// each connected producer pool feeds its own stream of the mixer, so several may play at once
+#ifndef PICO_HOST_AUDIO_MAX_STREAMS
+#define PICO_HOST_AUDIO_MAX_STREAMS 8
+#endif
+
+struct native_audio_stream {
+    // first, so the connection passed to producer_pool_give leads back to the stream
+    struct audio_connection connection;
+    // converts from the producer's format to the device's (consumer_format)
+    struct host_audio_pipeline *pipeline;
+    struct host_audio_mixer_stream *mix;
+};
+
+static struct host_audio_mixer *native_mixer;
+static struct native_audio_stream *native_streams[PICO_HOST_AUDIO_MAX_STREAMS];
+static uint native_stream_count;
+// how much converted audio each stream may queue ahead of the device; set by the backend's setup
+static uint native_stream_ring_frames;
+static float native_gain = 1.f;
+static bool native_gain_set; // by host_audio_set_gain
+
+// a buffer given by the producer, and how far through it the backend has got
+struct native_audio_source {
+    struct host_audio_pipeline *pipeline;
+    struct audio_buffer *buffer;
+    uint frame;
+    bool exhausted;
+};
+
+// converts up to frames frames of the source into dest, returning the number written. The source is marked
+// exhausted once it has no more output to give
+static uint native_audio_fill(struct native_audio_source *source, int16_t *dest, uint frames) {
+    uint used;
+    uint n = host_audio_pipeline_process(source->pipeline,
+                                         source->buffer->buffer->bytes + source->frame * source->buffer->format->sample_stride,
+                                         source->buffer->sample_count - source->frame, &used, dest, frames);
+    source->frame += used;
+    source->exhausted = n < frames;
+    return n;
+}
+
+static struct host_audio_pipeline *native_audio_create_pipeline(struct audio_buffer_pool *producer) {
+    struct host_audio_pipeline_config config = {
+            .input_channels = producer->format->channel_count,
+            .input_rate = producer->format->sample_freq,
+            .output_channels = consumer_format.channel_count,
+            .output_rate = consumer_format.sample_freq,
+    };
+    switch (producer->format->format) {
+        case AUDIO_BUFFER_FORMAT_PCM_S16:
+            config.input_format = HOST_AUDIO_SAMPLE_S16;
+            break;
+        case AUDIO_BUFFER_FORMAT_PCM_S8:
+            config.input_format = HOST_AUDIO_SAMPLE_S8;
+            break;
+        case AUDIO_BUFFER_FORMAT_PCM_U16:
+            config.input_format = HOST_AUDIO_SAMPLE_U16;
+            break;
+        case AUDIO_BUFFER_FORMAT_PCM_U8:
+            config.input_format = HOST_AUDIO_SAMPLE_U8;
+            break;
+        default:
+            return NULL;
+    }
+    struct host_audio_pipeline *pipeline = host_audio_pipeline_create(&config);
+    if (!pipeline) return NULL;
+    host_audio_pipeline_set_gain(pipeline, native_gain);
+    return pipeline;
+}
+
+void host_audio_set_gain(float gain) {
+    native_gain = gain;
+    native_gain_set = true;
+    for (uint i = 0; i < native_stream_count; i++) {
+        host_audio_pipeline_set_gain(native_streams[i]->pipeline, gain);
+    }
+}
+
+// device buffering when neither the firmware nor the user asks for a particular latency
+#ifndef PICO_HOST_AUDIO_DEFAULT_LATENCY_MS
+#define PICO_HOST_AUDIO_DEFAULT_LATENCY_MS 50
+#endif
+// periods per buffer when only the buffer size is given
+#ifndef PICO_HOST_AUDIO_DEFAULT_PERIODS
+#define PICO_HOST_AUDIO_DEFAULT_PERIODS 4
+#endif
+#define NATIVE_AUDIO_MIN_PERIOD_FRAMES 32
+
+static int32_t requested_max_latency_ms = -1;
+static uint requested_buffer_frames;
+static uint requested_period_frames;
+
+void host_audio_set_max_latency_ms(int32_t max_latency_ms) {
+    requested_max_latency_ms = max_latency_ms;
+}
+
+void host_audio_set_buffer_frames(uint buffer_frames, uint period_frames) {
+    requested_buffer_frames = buffer_frames;
+    requested_period_frames = period_frames;
+}
+
+// whether the device writer waits for a period's worth of audio before writing, rather than writing each producer
+// buffer as it arrives (only while the device has more than a period left to play)
+#ifndef PICO_HOST_AUDIO_COALESCE_WRITES
+#define PICO_HOST_AUDIO_COALESCE_WRITES 1
+#endif
+static int requested_coalesce_writes = -1;
+
+void host_audio_set_coalesce_writes(bool coalesce) {
+    requested_coalesce_writes = coalesce;
+}
+
+static uint env_uint(const char *name) {
+    const char *value = getenv(name);
+    return value ? (uint) strtoul(value, NULL, 10) : 0;
+}
+
+// picks the device buffer and period sizes (in frames at rate) from, in order of preference: the host_audio_
+// setters, the environment, and the max_latency_ms the firmware passed to the setup function
+static void native_audio_choose_buffering(uint rate, int32_t max_latency_ms, uint *buffer_frames, uint *period_frames) {
+    uint latency_ms = requested_max_latency_ms > 0 ? (uint) requested_max_latency_ms : env_uint("PICO_HOST_SDL_AUDIO_LATENCY_MS");
+    if (!latency_ms) latency_ms = max_latency_ms > 0 ? (uint) max_latency_ms : PICO_HOST_AUDIO_DEFAULT_LATENCY_MS;
+    uint buffer = requested_buffer_frames ? requested_buffer_frames : env_uint("PICO_HOST_SDL_AUDIO_BUFFER_FRAMES");
+    if (!buffer) buffer = (uint) (((uint64_t) rate * latency_ms) / 1000);
+    uint period = requested_period_frames ? requested_period_frames : env_uint("PICO_HOST_SDL_AUDIO_PERIOD_FRAMES");
+    if (!period) period = buffer / PICO_HOST_AUDIO_DEFAULT_PERIODS;
+    period = MAX(period, NATIVE_AUDIO_MIN_PERIOD_FRAMES);
+    *buffer_frames = MAX(buffer, 2 * period);
+    *period_frames = period;
+}
+
+static uint32_t frames_to_us(uint64_t frames, uint rate) {
+    return rate ? (uint32_t) ((frames * 1000000) / rate) : 0;
+}
+
+// counters behind host_audio_get_stats; updated by whichever thread notices the event
+static struct {
+    atomic_uint underruns;
+    atomic_uint recoveries;
+    atomic_uint buffers_written;
+    atomic_uint device_writes;
+    atomic_uint_fast64_t producer_block_us;
+    atomic_uint peak_latency_us;
+} audio_stats;
+static SDL_TimerID audio_stats_timer;
+
+static uint64_t ticks_to_us(uint64_t ticks) {
+    return ticks * 1000000 / SDL_GetPerformanceFrequency();
+}
+
+static void audio_stats_note_latency(uint32_t latency_us) {
+    uint peak = atomic_load_explicit(&audio_stats.peak_latency_us, memory_order_relaxed);
+    while (latency_us > peak &&
+           !atomic_compare_exchange_weak_explicit(&audio_stats.peak_latency_us, &peak, latency_us,
+                                                  memory_order_relaxed, memory_order_relaxed)) {
+    }
+}
+
+// called on the producing core once a producer buffer has been fully consumed. The latency is sampled by the
+// thread writing to the device instead, as measuring it may mean asking the device (e.g. snd_pcm_delay)
+static void audio_stats_buffer_written(void) {
+    atomic_fetch_add_explicit(&audio_stats.buffers_written, 1, memory_order_relaxed);
+}
+
+static void audio_stats_producer_blocked(uint64_t start_ticks) {
+    atomic_fetch_add_explicit(&audio_stats.producer_block_us, ticks_to_us(SDL_GetPerformanceCounter() - start_ticks),
+                              memory_order_relaxed);
+}
+
 #ifdef NATIVE_AUDIO_ALSA
 static int alsa_first_time = 1;
 static snd_pcm_t *pcm = NULL;
 static char pcmname[64];
 
+// write by converting directly into the mmap-ed ring buffer; falls back to snd_pcm_writei if the device doesn't
+// support mmap access
+#ifndef PICO_HOST_ALSA_USE_MMAP
+#define PICO_HOST_ALSA_USE_MMAP 1
+#endif
+static bool alsa_mmap;
+
+static snd_pcm_uframes_t alsa_buffer_frames;
+static snd_pcm_uframes_t alsa_period_frames;
+static atomic_uint_fast64_t alsa_frames_written;
+static bool alsa_coalesce_writes;
+
+static float alsa_queue_fill(void) {
+    snd_pcm_sframes_t delay;
+    if (!alsa_buffer_frames || snd_pcm_delay(pcm, &delay) < 0 || delay < 0) return 0;
+    return (float) delay / alsa_buffer_frames;
+}
+
 static void close_alsa_output(void) {
     if (!pcm) return;
 //    printf("Shutting down sound output\n");
@@ -50,13 +252,13 @@ void native_audio_enable(bool enable) {
     snd_pcm_pause(pcm, !enable);
 }
 
-const struct audio_format *native_audio_setup(const struct audio_format *intended_audio_format)
+const struct audio_format *native_audio_setup(const struct audio_format *intended_audio_format, int32_t max_latency_ms)
 {
     snd_pcm_hw_params_t *hw;
     snd_pcm_sw_params_t *sw;
     int err;
-    unsigned int alsa_buffer_time;
-    unsigned int alsa_period_time;
+    uint buffer_frames;
+    uint period_frames;
     unsigned int r;
 
     if (!pcmname[0]) {
@@ -76,7 +278,8 @@ const struct audio_format *native_audio_setup(const struct audio_format *intende
         goto fail;
     }
 
-    if ((err = snd_pcm_hw_params_set_access(pcm, hw, SND_PCM_ACCESS_RW_INTERLEAVED)) < 0) {
+    alsa_mmap = PICO_HOST_ALSA_USE_MMAP && snd_pcm_hw_params_set_access(pcm, hw, SND_PCM_ACCESS_MMAP_INTERLEAVED) >= 0;
+    if (!alsa_mmap && (err = snd_pcm_hw_params_set_access(pcm, hw, SND_PCM_ACCESS_RW_INTERLEAVED)) < 0) {
         printf("Cannot set access mode: %s.\n", snd_strerror(err));
         goto fail;
     }
@@ -104,16 +307,18 @@ const struct audio_format *native_audio_setup(const struct audio_format *intende
         printf("ALSA: sample rate set to %uHz instead of %u\n", rate, r);
     }
 
-    alsa_buffer_time = 500000;
-    alsa_period_time = 50000;
+    native_audio_choose_buffering(rate, max_latency_ms, &buffer_frames, &period_frames);
+    alsa_period_frames = period_frames;
+    snd_pcm_uframes_t alsa_requested_buffer_frames = buffer_frames;
 
-    if ((err = snd_pcm_hw_params_set_buffer_time_near(pcm, hw, &alsa_buffer_time, 0)) < 0) {
-        printf("Set buffer time failed: %s.\n", snd_strerror(err));
+    // the period first, so the buffer can be rounded to a whole number of them
+    if ((err = snd_pcm_hw_params_set_period_size_near(pcm, hw, &alsa_period_frames, 0)) < 0) {
+        printf("Set period size failed: %s.\n", snd_strerror(err));
         goto fail;
     }
 
-    if ((err = snd_pcm_hw_params_set_period_time_near(pcm, hw, &alsa_period_time, 0)) < 0) {
-        printf("Set period time failed: %s.\n", snd_strerror(err));
+    if ((err = snd_pcm_hw_params_set_buffer_size_near(pcm, hw, &alsa_requested_buffer_frames)) < 0) {
+        printf("Set buffer size failed: %s.\n", snd_strerror(err));
         goto fail;
     }
 
@@ -122,6 +327,10 @@ const struct audio_format *native_audio_setup(const struct audio_format *intende
         goto fail;
     }
 
+    if (snd_pcm_get_params(pcm, &alsa_buffer_frames, &alsa_period_frames) < 0) {
+        alsa_buffer_frames = alsa_requested_buffer_frames;
+    }
+
     snd_pcm_sw_params_alloca(&sw);
     snd_pcm_sw_params_current(pcm, sw);
     if (snd_pcm_sw_params(pcm, sw) < 0) {
@@ -129,359 +338,653 @@ const struct audio_format *native_audio_setup(const struct audio_format *intende
         goto fail;
     }
 
+    printf("ALSA: buffer %lu frames (%u us), period %lu frames (%u us)\n", (unsigned long) alsa_buffer_frames,
+           frames_to_us(alsa_buffer_frames, rate), (unsigned long) alsa_period_frames,
+           frames_to_us(alsa_period_frames, rate));
+    // the device does most of the buffering; each stream only needs enough to keep ahead of the writer
+    native_stream_ring_frames = 2 * alsa_period_frames;
+    if (requested_coalesce_writes >= 0) {
+        alsa_coalesce_writes = requested_coalesce_writes;
+    } else {
+        const char *coalesce = getenv("PICO_HOST_SDL_AUDIO_COALESCE");
+        alsa_coalesce_writes = coalesce ? strcmp(coalesce, "0") != 0 : PICO_HOST_AUDIO_COALESCE_WRITES;
+    }
+    host_video_audio_queue_fill_fn = alsa_queue_fill;
+
     consumer_format = *intended_audio_format;
+    // the device may not support the intended rate exactly; producers are resampled to whatever it runs at
+    consumer_format.sample_freq = rate;
     return intended_audio_format;
 
     fail:   close_alsa_output();
     return NULL;
 }
 
-void alsa_producer_pool_blocking_give_s16(struct audio_connection *connection, struct audio_buffer *buffer)
-{
-    // todo this is wrong for setting a single channel of stereo via non interleave
-    uint8_t *output_data = buffer->buffer->bytes;
-    int sample_count = buffer->sample_count;
-    int err;
-    while (sample_count > 0) {
-        if ((err = snd_pcm_writei(pcm, output_data, sample_count)) < 0) {
-            if (snd_pcm_state(pcm) == SND_PCM_STATE_XRUN) {
-                if ((err = snd_pcm_prepare(pcm)) < 0)
-                    printf("\nsnd_pcm_prepare() failed.\n");
-                alsa_first_time = 1;
-                continue;
-            }
-            panic("failed to send sound data");
-        }
-        sample_count -= err;
-        output_data += snd_pcm_frames_to_bytes(pcm, err);
-        if (alsa_first_time) {
-            alsa_first_time = 0;
-            snd_pcm_start(pcm);
-        }
+static void alsa_recover_xrun(void) {
+    if (snd_pcm_state(pcm) != SND_PCM_STATE_XRUN) {
+        panic("failed to send sound data");
     }
-    queue_free_audio_buffer(connection->producer_pool, buffer);
+    atomic_fetch_add_explicit(&audio_stats.underruns, 1, memory_order_relaxed);
+    if (snd_pcm_prepare(pcm) < 0)
+        printf("\nsnd_pcm_prepare() failed.\n");
+    else
+        atomic_fetch_add_explicit(&audio_stats.recoveries, 1, memory_order_relaxed);
+    alsa_first_time = 1;
 }
 
-void alsa_producer_pool_blocking_give_upsample_s16(struct audio_connection *connection, struct audio_buffer *buffer)
-{
-    static int16_t sample_buffer[16384];
-    // todo this is wrong for setting a single channel of stereo via non interleave
-    uint8_t *output_data = buffer->buffer->bytes;
-    assert(connection->producer_pool->format->sample_freq < connection->consumer_pool->format->sample_freq);
-    int sample_count = (buffer->sample_count * connection->consumer_pool->format->sample_freq)/connection->producer_pool->format->sample_freq;
-    int channel_sample_count = sample_count * buffer->format->format->channel_count;
-    assert(channel_sample_count < count_of(sample_buffer));
-    uint j = 0;
-    uint frac = (65536 * connection->producer_pool->format->sample_freq) / connection->consumer_pool->format->sample_freq;
-    for(uint i=0;i<channel_sample_count;i++) {
-        sample_buffer[i] = ((int16_t *)buffer->buffer->bytes)[j>>16];
-        j += frac;
+// mixes up to frames frames straight into the ALSA ring buffer, so each sample is only copied once after conversion
+static void alsa_write_mmap(uint frames) {
+    snd_pcm_sframes_t avail = snd_pcm_avail_update(pcm);
+    if (avail < 0) {
+        alsa_recover_xrun();
+        return;
     }
-    int err;
-    while (sample_count > 0) {
-        if ((err = snd_pcm_writei(pcm, sample_buffer, sample_count)) < 0) {
-            if (snd_pcm_state(pcm) == SND_PCM_STATE_XRUN) {
-                if ((err = snd_pcm_prepare(pcm)) < 0)
-                    printf("\nsnd_pcm_prepare() failed.\n");
-                alsa_first_time = 1;
-                continue;
-            }
-            panic("failed to send sound data");
-        }
-        sample_count -= err;
-        output_data += snd_pcm_frames_to_bytes(pcm, err);
+    if (!avail) {
+        // the ring is full; it won't drain unless the stream has been started
         if (alsa_first_time) {
             alsa_first_time = 0;
             snd_pcm_start(pcm);
         }
+        if (snd_pcm_wait(pcm, 1000) < 0) alsa_recover_xrun();
+        return;
+    }
+    const snd_pcm_channel_area_t *areas;
+    snd_pcm_uframes_t offset;
+    snd_pcm_uframes_t n = MIN((snd_pcm_uframes_t) avail, frames);
+    if (snd_pcm_mmap_begin(pcm, &areas, &offset, &n) < 0) {
+        alsa_recover_xrun();
+        return;
+    }
+    // interleaved, so all channels share the first area
+    int16_t *dest = (int16_t *) ((uint8_t *) areas[0].addr + areas[0].first / 8 + offset * (areas[0].step / 8));
+    uint produced = host_audio_mixer_mix(native_mixer, dest, n);
+    snd_pcm_sframes_t committed = snd_pcm_mmap_commit(pcm, offset, produced);
+    if (committed < 0 || (uint) committed != produced) {
+        alsa_recover_xrun();
+        return;
+    }
+    atomic_fetch_add_explicit(&alsa_frames_written, produced, memory_order_relaxed);
+    atomic_fetch_add_explicit(&audio_stats.device_writes, 1, memory_order_relaxed);
+    if (produced && alsa_first_time) {
+        alsa_first_time = 0;
+        snd_pcm_start(pcm);
     }
-    queue_free_audio_buffer(connection->producer_pool, buffer);
 }
 
-void alsa_producer_pool_blocking_give_s8(struct audio_connection *connection, struct audio_buffer *buffer)
-{
+static void alsa_write_rw(uint frames) {
     static int16_t sample_buffer[16384];
-    // todo this is wrong for setting a single channel of stereo via non interleave
-    uint8_t *output_data = buffer->buffer->bytes;
-    int sample_count = buffer->sample_count;
-    int channel_sample_count = sample_count * buffer->format->format->channel_count;
-    assert(channel_sample_count < count_of(sample_buffer));
-    for(uint i=0;i<channel_sample_count;i++) {
-        sample_buffer[i] = buffer->buffer->bytes[i] << 8u;
-    }
-    int err;
-    while (sample_count > 0) {
-        if ((err = snd_pcm_writei(pcm, sample_buffer, sample_count)) < 0) {
-            if (snd_pcm_state(pcm) == SND_PCM_STATE_XRUN) {
-                if ((err = snd_pcm_prepare(pcm)) < 0)
-                    printf("\nsnd_pcm_prepare() failed.\n");
-                alsa_first_time = 1;
-                continue;
-            }
-            panic("failed to send sound data");
+    uint channels = consumer_format.channel_count;
+    const int16_t *output_data = sample_buffer;
+    frames = host_audio_mixer_mix(native_mixer, sample_buffer, MIN(frames, count_of(sample_buffer) / channels));
+    while (frames) {
+        snd_pcm_sframes_t err = snd_pcm_writei(pcm, output_data, frames);
+        atomic_fetch_add_explicit(&audio_stats.device_writes, 1, memory_order_relaxed);
+        if (err < 0) {
+            alsa_recover_xrun();
+            continue;
         }
-        sample_count -= err;
-        output_data += snd_pcm_frames_to_bytes(pcm, err);
+        atomic_fetch_add_explicit(&alsa_frames_written, err, memory_order_relaxed);
+        frames -= err;
+        output_data += err * channels;
         if (alsa_first_time) {
             alsa_first_time = 0;
             snd_pcm_start(pcm);
         }
     }
-    queue_free_audio_buffer(connection->producer_pool, buffer);
 }
 
-void alsa_producer_pool_blocking_give_upsample_s8(struct audio_connection *connection, struct audio_buffer *buffer)
-{
-    static int16_t sample_buffer[16384];
-    // todo this is wrong for setting a single channel of stereo via non interleave
-    uint8_t *output_data = buffer->buffer->bytes;
-    assert(connection->producer_pool->format->sample_freq < connection->consumer_pool->format->sample_freq);
-    int sample_count = (buffer->sample_count * connection->consumer_pool->format->sample_freq)/connection->producer_pool->format->sample_freq;
-    int channel_sample_count = sample_count * buffer->format->format->channel_count;
-    assert(channel_sample_count < count_of(sample_buffer));
-    uint j = 0;
-    uint frac = (65536 * connection->producer_pool->format->sample_freq) / connection->consumer_pool->format->sample_freq;
-    for(uint i=0;i<channel_sample_count;i++) {
-        sample_buffer[i] = buffer->buffer->bytes[j>>16] << 8u;
-        j += frac;
-    }
-    int err;
-    while (sample_count > 0) {
-        if ((err = snd_pcm_writei(pcm, sample_buffer, sample_count)) < 0) {
-            if (snd_pcm_state(pcm) == SND_PCM_STATE_XRUN) {
-                if ((err = snd_pcm_prepare(pcm)) < 0)
-                    printf("\nsnd_pcm_prepare() failed.\n");
-                alsa_first_time = 1;
+static SDL_Thread *alsa_writer_thread;
+
+// frames written to the device but not yet played
+static snd_pcm_sframes_t alsa_delay(void) {
+    snd_pcm_sframes_t delay;
+    if (!pcm || snd_pcm_delay(pcm, &delay) < 0 || delay < 0) return 0;
+    return delay;
+}
+
+// mixes the streams into the device as their audio arrives. A stream that is behind the others holds up mixing
+// until the device is down to its last period, at which point it is mixed as silence rather than let the device
+// run dry. When coalescing, small producer buffers are likewise held back until there is a whole period of them
+// (or the device is down to its last period), so each write to the device is normally at least a period
+static int alsa_writer_thread_func(void *arg) {
+    host_thread_set_id(HOST_THREAD_AUDIO);
+    while (true) {
+        uint frames = host_audio_mixer_ready(native_mixer);
+        uint wanted = alsa_coalesce_writes ? (uint) alsa_period_frames : 1;
+        if (frames < wanted) {
+            uint queued = host_audio_mixer_queued(native_mixer);
+            if (!queued) {
+                host_audio_mixer_wait(native_mixer, 100);
+                continue;
+            }
+            snd_pcm_sframes_t delay = alsa_first_time ? 0 : alsa_delay();
+            if ((snd_pcm_uframes_t) delay > alsa_period_frames) {
+                SDL_Delay(MAX(1u, frames_to_us(delay - alsa_period_frames, consumer_format.sample_freq) / 1000));
                 continue;
             }
-            panic("failed to send sound data");
+            if (!frames) frames = queued;
         }
-        sample_count -= err;
-        output_data += snd_pcm_frames_to_bytes(pcm, err);
-        if (alsa_first_time) {
-            alsa_first_time = 0;
-            snd_pcm_start(pcm);
+        host_trace_begin(HOST_TRACE_AUDIO_WRITE, frames);
+        if (alsa_mmap) {
+            alsa_write_mmap(frames);
+        } else {
+            alsa_write_rw(frames);
         }
+        host_trace_end(HOST_TRACE_AUDIO_WRITE, frames);
+        audio_stats_note_latency(native_audio_get_latency_us());
     }
-    queue_free_audio_buffer(connection->producer_pool, buffer);
+    return 0;
 }
 
+static uint32_t native_audio_get_latency_us(void) {
+    return frames_to_us((uint64_t) alsa_delay() + host_audio_mixer_queued(native_mixer), consumer_format.sample_freq);
+}
 
+static uint32_t native_audio_get_period_frames(void) {
+    return (uint32_t) alsa_period_frames;
+}
 
-static struct audio_connection alsa_blocking_give_audio_connection_s16 = {
-        .consumer_pool_take = consumer_pool_take_buffer_default,
-        .consumer_pool_give = consumer_pool_give_buffer_default,
-        .producer_pool_take = producer_pool_take_buffer_default,
-        .producer_pool_give = alsa_producer_pool_blocking_give_s16
-};
-
-static struct audio_connection alsa_blocking_give_upsample_audio_connection_s16 = {
-        .consumer_pool_take = consumer_pool_take_buffer_default,
-        .consumer_pool_give = consumer_pool_give_buffer_default,
-        .producer_pool_take = producer_pool_take_buffer_default,
-        .producer_pool_give = alsa_producer_pool_blocking_give_upsample_s16
-};
-
-
-static struct audio_connection alsa_blocking_give_audio_connection_s8 = {
-        .consumer_pool_take = consumer_pool_take_buffer_default,
-        .consumer_pool_give = consumer_pool_give_buffer_default,
-        .producer_pool_take = producer_pool_take_buffer_default,
-        .producer_pool_give = alsa_producer_pool_blocking_give_s8
-};
-
-static struct audio_connection alsa_blocking_give_upsample_audio_connection_s8 = {
-        .consumer_pool_take = consumer_pool_take_buffer_default,
-        .consumer_pool_give = consumer_pool_give_buffer_default,
-        .producer_pool_take = producer_pool_take_buffer_default,
-        .producer_pool_give = alsa_producer_pool_blocking_give_upsample_s8
-};
-
+static uint64_t native_audio_get_played_frames(void) {
+    uint64_t written = atomic_load_explicit(&alsa_frames_written, memory_order_relaxed);
+    uint64_t delay = (uint64_t) alsa_delay();
+    return written > delay ? written - delay : 0;
+}
 
 bool native_audio_connect(struct audio_buffer_pool *producer)
 {
     printf("Connecting ALSA audio\n");
-
-    // todo we need to pick a connection based on the frequency - e.g. 22050 can be more simply upsampled to 44100
-
-
-    consumer_buffer_format.sample_stride = consumer_format.channel_count * 2;
-
-    // todo don't need a consumer pool, but have to specify one in current api
-    struct audio_buffer_pool *consumer = audio_new_consumer_pool(&consumer_buffer_format, 0, 0);
-
-    if (producer->format->format == AUDIO_BUFFER_FORMAT_PCM_S16) {
-        if (consumer->format->sample_freq == producer->format->sample_freq) {
-            audio_complete_connection(&alsa_blocking_give_audio_connection_s16, producer, consumer);
-        } else {
-            audio_complete_connection(&alsa_blocking_give_upsample_audio_connection_s16, producer, consumer);
-        }
-    } else if (producer->format->format == AUDIO_BUFFER_FORMAT_PCM_S8) {
-        if (consumer->format->sample_freq == producer->format->sample_freq) {
-            audio_complete_connection(&alsa_blocking_give_audio_connection_s8, producer, consumer);
-        } else {
-            audio_complete_connection(&alsa_blocking_give_upsample_audio_connection_s8, producer, consumer);
-        }
-    } else {
-        return false;
+    if (!alsa_writer_thread) {
+        alsa_writer_thread = SDL_CreateThread(alsa_writer_thread_func, "ALSA writer", NULL);
     }
     return true;
 }
 
 #endif
 #ifdef NATIVE_AUDIO_SDL2
+
 SDL_AudioDeviceID sdl_audio_device_id;
 SDL_AudioSpec* sdl_audio_spec = NULL;
 int bytes_per_frame;
-int max_latency_bytes;
+// frames handed to the device by the callback, and when it last ran
+static atomic_uint_fast64_t sdl_frames_consumed;
+static atomic_uint_fast64_t sdl_callback_ticks;
+
+static float sdl_queue_fill(void) {
+    return (float) host_audio_mixer_queued(native_mixer) / native_stream_ring_frames;
+}
 
-const struct audio_format *native_audio_setup(const struct audio_format *intended_audio_format)
+static void sdl_audio_callback(void *userdata, Uint8 *stream, int len) {
+    uint frames = len / bytes_per_frame;
+    host_thread_set_id(HOST_THREAD_AUDIO);
+    host_trace_begin(HOST_TRACE_AUDIO_WRITE, frames);
+    // any shortfall is played as silence
+    uint n = host_audio_mixer_mix(native_mixer, (int16_t *) stream, frames);
+    host_trace_end(HOST_TRACE_AUDIO_WRITE, frames);
+    atomic_store_explicit(&sdl_callback_ticks, SDL_GetPerformanceCounter(), memory_order_relaxed);
+    atomic_fetch_add_explicit(&sdl_frames_consumed, frames, memory_order_relaxed);
+    atomic_fetch_add_explicit(&audio_stats.device_writes, 1, memory_order_relaxed);
+    audio_stats_note_latency(native_audio_get_latency_us());
+    // counted once per run of short callbacks (and not before a producer has started)
+    static bool started, underrun;
+    started |= n != 0;
+    if (n < frames && started && !underrun) {
+        underrun = true;
+        atomic_fetch_add_explicit(&audio_stats.underruns, 1, memory_order_relaxed);
+    } else if (n == frames && underrun) {
+        underrun = false;
+        atomic_fetch_add_explicit(&audio_stats.recoveries, 1, memory_order_relaxed);
+    }
+}
+
+static uint32_t native_audio_get_latency_us(void) {
+    if (!sdl_audio_spec) return 0;
+    // what is queued in the streams, plus (approximately) the callback buffer SDL is playing from
+    return frames_to_us(host_audio_mixer_queued(native_mixer) + sdl_audio_spec->samples, sdl_audio_spec->freq);
+}
+
+static uint32_t native_audio_get_period_frames(void) {
+    return sdl_audio_spec->size / bytes_per_frame;
+}
+
+static uint64_t native_audio_get_played_frames(void) {
+    if (!sdl_audio_spec) return 0;
+    // the last callback's frames are (approximately) being played out since it ran; interpolate within them so the
+    // clock doesn't advance a whole callback at a time
+    uint64_t consumed = atomic_load_explicit(&sdl_frames_consumed, memory_order_relaxed);
+    uint64_t since = SDL_GetPerformanceCounter() - atomic_load_explicit(&sdl_callback_ticks, memory_order_relaxed);
+    uint64_t playing = MIN(since * sdl_audio_spec->freq / SDL_GetPerformanceFrequency(), sdl_audio_spec->samples);
+    return consumed > sdl_audio_spec->samples ? consumed - sdl_audio_spec->samples + playing : 0;
+}
+
+const struct audio_format *native_audio_setup(const struct audio_format *intended_audio_format, int32_t max_latency_ms)
 {
     SDL_AudioSpec *desired;
+    uint buffer_frames;
+    uint period_frames;
     desired = (SDL_AudioSpec *)calloc(1,sizeof(SDL_AudioSpec));
     desired->freq = intended_audio_format->sample_freq;
     assert(intended_audio_format->format == AUDIO_BUFFER_FORMAT_PCM_S16 || intended_audio_format->format == AUDIO_BUFFER_FORMAT_PCM_S8);
     desired->format = AUDIO_S16SYS;
     desired->channels = intended_audio_format->channel_count;
-    desired->samples = 1024; // todo random
-    desired->callback = NULL;//audio_callback;
+    native_audio_choose_buffering(desired->freq, max_latency_ms, &buffer_frames, &period_frames);
+    // SDL wants a power of two; round down so the latency stays within what was asked for
+    uint samples = 1;
+    while (samples * 2 <= MIN(period_frames, 32768u)) samples *= 2;
+    desired->samples = (Uint16) samples;
+    desired->callback = sdl_audio_callback;
     desired->userdata = NULL;
 
+    bytes_per_frame = desired->channels * 2;
+    // the rest of the buffering is in the streams between the producers and the callback, which hold at least two
+    // callbacks worth so the producers have time to refill them
+    native_stream_ring_frames = MAX(buffer_frames - desired->samples, 2u * desired->samples);
+
+    // the device starts paused, so the callback can't run until native_audio_enable
     if (SDL_OpenAudio(desired, NULL) != 0) {
         return NULL;
     }
-    bytes_per_frame = desired->channels * 2;
-    uint max_latency_ms = 100;
-    max_latency_bytes = (bytes_per_frame * desired->freq * max_latency_ms) / 1000;
-    printf("Max latency bytes %d\n", max_latency_bytes);
+    printf("SDL audio: ring %u frames, callback %u frames (%u us total)\n", native_stream_ring_frames,
+           desired->samples, frames_to_us(native_stream_ring_frames + desired->samples, desired->freq));
     sdl_audio_device_id = 1;
     sdl_audio_spec = desired;
+    host_video_audio_queue_fill_fn = sdl_queue_fill;
     consumer_format = *intended_audio_format;
 
     return intended_audio_format;
 }
 
-void sdl_producer_pool_blocking_give(struct audio_connection *connection, struct audio_buffer *buffer)
+bool native_audio_connect(struct audio_buffer_pool *producer)
 {
-    // todo yuck hack!!!! use the SDL callback now we have buffer pools
-    while (SDL_GetQueuedAudioSize(sdl_audio_device_id) > max_latency_bytes) {
-        tight_loop_contents();
+    printf("Connecting SDL2 audio\n");
+    return true;
+}
+
+// max_latency_ms may be -1
+// buffer_sample_count may be -1 and is per channel (it is the expected number of samples in buffered passed to audio_queue_samples (if known)
+extern void native_audio_enable(bool enable) {
+    SDL_PauseAudio(!enable);
+}
+
+//extern uint32_t audio_get_time_ms(int channel);
+//extern uint32_t audio_set_time_ms(int channel, uint32_t time_ms);
+//uint32_t audio_buffered_ms(uint channel) {
+//    assert(false);
+//    return 0;
+//}
+//
+
+#endif
+
+// Headless backend writing the converted audio to a WAV or raw file instead of a device; selected at runtime (before
+// setup) with host_audio_set_output_file or PICO_HOST_SDL_AUDIO_FILE. When paced, writes are throttled to the
+// nominal sample rate by the host clock (as a device would), otherwise audio is consumed as fast as it is produced
+#define FILE_AUDIO_WAV_HEADER_BYTES 44
+#define FILE_AUDIO_WRITE_BUFFER_BYTES 65536
+
+static char file_audio_path[256];
+static bool file_audio_paced = true;
+static bool file_audio_active;
+static bool file_audio_wav;
+static FILE *file_audio;
+static uint file_audio_period_frames;
+static volatile bool file_audio_enabled;
+static atomic_uint_fast64_t file_audio_frames_written; // also read by host_audio_get_clock_us
+static uint64_t file_audio_data_bytes;
+// host clock time (in performance counter ticks) that file_audio_clock_frames were due to be played at
+static uint64_t file_audio_clock_start;
+static uint64_t file_audio_clock_frames;
+static SDL_mutex *file_audio_mutex;
+
+void host_audio_set_output_file(const char *path, bool paced) {
+    if (path) {
+        strncpy(file_audio_path, path, sizeof(file_audio_path) - 1);
+    } else {
+        file_audio_path[0] = 0;
     }
-    assert(buffer->format->sample_stride == bytes_per_frame);
-    int __unused rc = SDL_QueueAudio(sdl_audio_device_id, buffer->buffer->bytes, buffer->sample_count * bytes_per_frame);
-    assert(!rc);
-    queue_free_audio_buffer(connection->producer_pool, buffer);
+    file_audio_paced = paced;
 }
 
-void sdl_producer_pool_blocking_give_s8(struct audio_connection *connection, struct audio_buffer *buffer)
-{
-    // todo yuck hack!!!! use the SDL callback now we have buffer pools
-    while (SDL_GetQueuedAudioSize(sdl_audio_device_id) > max_latency_bytes) {
-        tight_loop_contents();
+static bool file_audio_selected(void) {
+    static bool env_read;
+    if (!env_read) {
+        env_read = true;
+        const char *path = getenv("PICO_HOST_SDL_AUDIO_FILE");
+        const char *pacing = getenv("PICO_HOST_SDL_AUDIO_FILE_PACING");
+        if (path && !file_audio_path[0]) host_audio_set_output_file(path, file_audio_paced);
+        if (pacing) {
+            if (!strcmp(pacing, "clock")) file_audio_paced = true;
+            else if (!strcmp(pacing, "free")) file_audio_paced = false;
+            else printf("Unknown audio file pacing '%s'\n", pacing);
+        }
     }
-    static int16_t sample_buffer[16384];
-    // todo this is wrong for setting a single channel of stereo via non interleave
-    int sample_count = buffer->sample_count;
-    int channel_sample_count = sample_count * buffer->format->format->channel_count;
-    assert(channel_sample_count < count_of(sample_buffer));
-    for(uint i=0;i<channel_sample_count;i++) {
-        sample_buffer[i] = buffer->buffer->bytes[i] << 8u;
-    }
-    assert(buffer->format->sample_stride * 2 == bytes_per_frame);
-    int __unused rc = SDL_QueueAudio(sdl_audio_device_id, sample_buffer, buffer->sample_count * bytes_per_frame);
-    assert(!rc);
-    queue_free_audio_buffer(connection->producer_pool, buffer);
+    return file_audio_path[0] != 0;
 }
 
+static void file_audio_write_wav_header(void) {
+    uint8_t h[FILE_AUDIO_WAV_HEADER_BYTES];
+    uint channels = consumer_format.channel_count;
+    uint32_t data_bytes = (uint32_t) MIN(file_audio_data_bytes, 0xffffffffu - FILE_AUDIO_WAV_HEADER_BYTES);
+    uint8_t *p = h;
+    memcpy(p, "RIFF", 4);
+    p += 4;
+    put_le(&p, data_bytes + FILE_AUDIO_WAV_HEADER_BYTES - 8, 4);
+    memcpy(p, "WAVEfmt ", 8);
+    p += 8;
+    put_le(&p, 16, 4);
+    put_le(&p, 1, 2); // PCM
+    put_le(&p, channels, 2);
+    put_le(&p, consumer_format.sample_freq, 4);
+    put_le(&p, consumer_format.sample_freq * channels * 2, 4);
+    put_le(&p, channels * 2, 2);
+    put_le(&p, 16, 2);
+    memcpy(p, "data", 4);
+    p += 4;
+    put_le(&p, data_bytes, 4);
+    fseek(file_audio, 0, SEEK_SET);
+    fwrite(h, 1, sizeof(h), file_audio);
+}
 
-static struct audio_connection sdl_blocking_give_audio_connection_s16 = {
-        .consumer_pool_take = consumer_pool_take_buffer_default,
-        .consumer_pool_give = consumer_pool_give_buffer_default,
-        .producer_pool_take = producer_pool_take_buffer_default,
-        .producer_pool_give = sdl_producer_pool_blocking_give
-};
+static void file_audio_close(void) {
+    if (!file_audio) return;
+    SDL_LockMutex(file_audio_mutex);
+    // write out whatever is still queued
+    uint channels = consumer_format.channel_count;
+    int16_t sample_buffer[1024];
+    uint frames;
+    while (native_mixer && (frames = host_audio_mixer_mix(native_mixer, sample_buffer, count_of(sample_buffer) / channels))) {
+        fwrite(sample_buffer, channels * sizeof(int16_t), frames, file_audio);
+        file_audio_data_bytes += frames * channels * sizeof(int16_t);
+    }
+    if (file_audio_wav) {
+        // now the length is known
+        file_audio_write_wav_header();
+    }
+    fclose(file_audio);
+    file_audio = NULL;
+    SDL_UnlockMutex(file_audio_mutex);
+}
 
-static struct audio_connection sdl_blocking_give_audio_connection_s8 = {
-    .consumer_pool_take = consumer_pool_take_buffer_default,
-    .consumer_pool_give = consumer_pool_give_buffer_default,
-    .producer_pool_take = producer_pool_take_buffer_default,
-    .producer_pool_give = sdl_producer_pool_blocking_give_s8
-};
+// frames a device started at file_audio_clock_start would have played by now
+static uint64_t file_audio_due_frames(void) {
+    uint64_t elapsed = SDL_GetPerformanceCounter() - file_audio_clock_start;
+    return file_audio_clock_frames + elapsed * consumer_format.sample_freq / SDL_GetPerformanceFrequency();
+}
 
+static uint32_t file_audio_ahead_frames(void) {
+    if (!file_audio_paced || !file_audio_enabled) return 0;
+    uint64_t due = file_audio_due_frames();
+    return file_audio_frames_written > due ? (uint32_t) (file_audio_frames_written - due) : 0;
+}
 
-bool native_audio_connect(struct audio_buffer_pool *producer)
-{
-    printf("Connecting SDL2 audio\n");
+static float file_audio_queue_fill(void) {
+    return (float) host_audio_mixer_queued(native_mixer) / native_stream_ring_frames;
+}
 
-    // todo we need to pick a connection based on the frequency - e.g. 22050 can be more simply upsampled to 44100
-    consumer_buffer_format.sample_stride = consumer_format.channel_count * 2;
+static const struct audio_format *file_audio_setup(const struct audio_format *intended_audio_format, int32_t max_latency_ms) {
+    uint buffer_frames;
+    if (!file_audio) {
+        file_audio = fopen(file_audio_path, "wb");
+        if (!file_audio) {
+            printf("Error: can't open audio output file %s\n", file_audio_path);
+            return NULL;
+        }
+        setvbuf(file_audio, NULL, _IOFBF, FILE_AUDIO_WRITE_BUFFER_BYTES);
+        file_audio_mutex = SDL_CreateMutex();
+        atexit(file_audio_close);
+    }
+    consumer_format = *intended_audio_format;
+    const char *ext = strrchr(file_audio_path, '.');
+    file_audio_wav = ext && !strcasecmp(ext, ".wav");
+    if (file_audio_wav) {
+        // placeholder until the length is known
+        file_audio_write_wav_header();
+    }
+    // the pacing runs at most a period ahead of the clock, as a device would
+    native_audio_choose_buffering(consumer_format.sample_freq, max_latency_ms, &buffer_frames, &file_audio_period_frames);
+    native_stream_ring_frames = buffer_frames;
+    host_video_audio_queue_fill_fn = file_audio_queue_fill;
+    printf("Audio to %s file %s (%s)\n", file_audio_wav ? "WAV" : "raw", file_audio_path,
+           file_audio_paced ? "paced" : "free running");
+    return intended_audio_format;
+}
 
-    // todo don't need a consumer pool, but have to specify one in current api
-    struct audio_buffer_pool *consumer = audio_new_consumer_pool(&consumer_buffer_format, 0, 0);
+static void file_audio_enable(bool enable) {
+    if (enable && !file_audio_enabled) {
+        file_audio_clock_start = SDL_GetPerformanceCounter();
+        file_audio_clock_frames = file_audio_frames_written;
+    }
+    file_audio_enabled = enable;
+}
+
+// mixes queued audio into the file. When paced, audio is only written while the file is no more than a period
+// ahead of the clock; if make_room, this waits for the clock as needed to write at least one chunk, and mixes
+// streams that are behind the others as silence rather than wait for them
+static void file_audio_pump(bool make_room) {
+    static int16_t sample_buffer[16384];
+    uint channels = consumer_format.channel_count;
+    SDL_LockMutex(file_audio_mutex);
+    if (!file_audio) {
+        // closed on exit while another core is still giving buffers; drop what is queued, so it doesn't wait forever
+        if (make_room) {
+            uint frames = MIN(host_audio_mixer_queued(native_mixer), count_of(sample_buffer) / channels);
+            host_audio_mixer_mix(native_mixer, sample_buffer, frames);
+        }
+        SDL_UnlockMutex(file_audio_mutex);
+        return;
+    }
+    while (true) {
+        if (file_audio_paced && file_audio_enabled) {
+            if (file_audio_frames_written && file_audio_due_frames() > file_audio_frames_written) {
+                // a device would have run dry; restart the clock from here, as it would
+                atomic_fetch_add_explicit(&audio_stats.underruns, 1, memory_order_relaxed);
+                atomic_fetch_add_explicit(&audio_stats.recoveries, 1, memory_order_relaxed);
+                file_audio_clock_start = SDL_GetPerformanceCounter();
+                file_audio_clock_frames = file_audio_frames_written;
+            }
+            uint32_t ahead = file_audio_ahead_frames();
+            if (ahead > file_audio_period_frames) {
+                if (!make_room) break;
+                SDL_Delay(MAX(1u, frames_to_us(ahead - file_audio_period_frames, consumer_format.sample_freq) / 1000));
+                continue;
+            }
+        }
+        uint frames = host_audio_mixer_ready(native_mixer);
+        if (!frames && make_room) frames = host_audio_mixer_queued(native_mixer);
+        if (!frames) break;
+        if (file_audio_paced) frames = MIN(frames, file_audio_period_frames);
+        host_trace_begin(HOST_TRACE_AUDIO_WRITE, frames);
+        frames = host_audio_mixer_mix(native_mixer, sample_buffer, MIN(frames, count_of(sample_buffer) / channels));
+        fwrite(sample_buffer, channels * sizeof(int16_t), frames, file_audio);
+        host_trace_end(HOST_TRACE_AUDIO_WRITE, frames);
+        atomic_fetch_add_explicit(&audio_stats.device_writes, 1, memory_order_relaxed);
+        file_audio_frames_written += frames;
+        file_audio_data_bytes += frames * channels * sizeof(int16_t);
+        audio_stats_note_latency(host_audio_get_latency_us());
+        make_room = false;
+    }
+    SDL_UnlockMutex(file_audio_mutex);
+}
+
+// the device period, so producers can size their buffers to match what is written to the device at once
+uint32_t audio_get_optimal_buffer_sample_count() {
+    if (file_audio_active) return file_audio_period_frames;
+    return native_audio_get_period_frames();
+}
 
-    if (producer->format->format == AUDIO_BUFFER_FORMAT_PCM_S16) {
-        audio_complete_connection(&sdl_blocking_give_audio_connection_s16, producer, consumer);
-    } else if (producer->format->format == AUDIO_BUFFER_FORMAT_PCM_S8) {
-        audio_complete_connection(&sdl_blocking_give_audio_connection_s8, producer, consumer);
+bool host_audio_get_clock_us(uint64_t *us) {
+    if (!native_mixer) return false;
+    uint64_t played;
+    if (file_audio_active) {
+        // written frames are "played" as soon as they are due, or immediately if not paced
+        played = file_audio_frames_written;
+        if (file_audio_paced && file_audio_enabled) played = MIN(played, file_audio_due_frames());
     } else {
-        return false;
+        played = native_audio_get_played_frames();
     }
+    *us = played * 1000000 / consumer_format.sample_freq;
     return true;
 }
 
-// max_latency_ms may be -1
-// buffer_sample_count may be -1 and is per channel (it is the expected number of samples in buffered passed to audio_queue_samples (if known)
-extern void native_audio_enable(bool enable) {
-    SDL_PauseAudio(!enable);
+uint32_t host_audio_get_latency_us(void) {
+    if (!native_mixer) return 0;
+    if (file_audio_active) {
+        return frames_to_us(file_audio_ahead_frames() + host_audio_mixer_queued(native_mixer), consumer_format.sample_freq);
+    }
+    return native_audio_get_latency_us();
 }
 
-//extern uint32_t audio_get_time_ms(int channel);
-//extern uint32_t audio_set_time_ms(int channel, uint32_t time_ms);
-//uint32_t audio_buffered_ms(uint channel) {
-//    assert(false);
-//    return 0;
-//}
-//
+void host_audio_get_stats(struct host_audio_stats *stats) {
+    stats->underruns = atomic_load_explicit(&audio_stats.underruns, memory_order_relaxed);
+    stats->recoveries = atomic_load_explicit(&audio_stats.recoveries, memory_order_relaxed);
+    stats->buffers_written = atomic_load_explicit(&audio_stats.buffers_written, memory_order_relaxed);
+    stats->device_writes = atomic_load_explicit(&audio_stats.device_writes, memory_order_relaxed);
+    stats->producer_block_us = atomic_load_explicit(&audio_stats.producer_block_us, memory_order_relaxed);
+    stats->latency_us = host_audio_get_latency_us();
+    stats->queued_frames = (uint32_t) (((uint64_t) stats->latency_us * consumer_format.sample_freq) / 1000000);
+    audio_stats_note_latency(stats->latency_us);
+    stats->peak_latency_us = atomic_load_explicit(&audio_stats.peak_latency_us, memory_order_relaxed);
+}
 
-uint32_t audio_get_optimal_buffer_sample_count() {
-    return sdl_audio_spec->size / bytes_per_frame;
+void host_audio_reset_stats(void) {
+    atomic_store(&audio_stats.underruns, 0);
+    atomic_store(&audio_stats.recoveries, 0);
+    atomic_store(&audio_stats.buffers_written, 0);
+    atomic_store(&audio_stats.device_writes, 0);
+    atomic_store(&audio_stats.producer_block_us, 0);
+    atomic_store(&audio_stats.peak_latency_us, 0);
+}
+
+static Uint32 audio_stats_log(Uint32 interval, void *param) {
+    struct host_audio_stats stats;
+    host_audio_get_stats(&stats);
+    printf("Audio: %u underruns, %u recoveries, %u buffers, %u device writes, producer blocked %.1fms, "
+           "%u frames queued, latency %.1fms (peak %.1fms)\n", stats.underruns, stats.recoveries,
+           stats.buffers_written, stats.device_writes,
+           stats.producer_block_us / 1000.0, stats.queued_frames, stats.latency_us / 1000.0,
+           stats.peak_latency_us / 1000.0);
+    return interval;
+}
+
+// The device is opened by the first setup call. Later ones (e.g. for a second producer using the other audio API)
+// share it, their producers being converted to its format and mixed in
+static const struct audio_format *audio_backend_setup(const struct audio_format *intended_audio_format, int32_t max_latency_ms) {
+    if (native_mixer) return intended_audio_format;
+    file_audio_active = file_audio_selected();
+    // the environment only gives the default, so loses to any earlier host_audio_set_gain
+    const char *gain = getenv("PICO_HOST_SDL_AUDIO_GAIN");
+    if (gain && !native_gain_set) native_gain = strtof(gain, NULL);
+    uint log_interval_ms = env_uint("PICO_HOST_SDL_AUDIO_STATS_MS");
+    if (log_interval_ms && !audio_stats_timer) {
+        audio_stats_timer = SDL_AddTimer(log_interval_ms, audio_stats_log, NULL);
+    }
+    const struct audio_format *format;
+    if (file_audio_active) {
+        format = file_audio_setup(intended_audio_format, max_latency_ms);
+    } else {
+        format = native_audio_setup(intended_audio_format, max_latency_ms);
+    }
+    if (format) {
+        native_mixer = host_audio_mixer_create(consumer_format.channel_count, PICO_HOST_AUDIO_MAX_STREAMS);
+        if (!native_mixer) return NULL;
+        host_video_audio_clock_fn = host_audio_get_clock_us;
+    }
+    return format;
+}
+
+// called on the producing core; blocks only while this producer's own stream is full
+static void audio_backend_producer_pool_give(struct audio_connection *connection, struct audio_buffer *buffer) {
+    struct native_audio_stream *stream = (struct native_audio_stream *) connection;
+    host_trace_begin(HOST_TRACE_AUDIO_GIVE, buffer->sample_count);
+    // todo this is wrong for setting a single channel of stereo via non interleave
+    struct native_audio_source source = {.pipeline = stream->pipeline, .buffer = buffer};
+    while (!source.exhausted) {
+        uint frames;
+        int16_t *dest = host_audio_mixer_stream_space(stream->mix, &frames);
+        if (!dest) {
+            uint64_t start = SDL_GetPerformanceCounter();
+            enum host_core_time_state previous = host_core_time_enter(HOST_CORE_TIME_AUDIO_BLOCKED);
+            if (file_audio_active) {
+                file_audio_pump(true);
+            } else {
+                host_audio_mixer_stream_wait(stream->mix);
+            }
+            host_core_time_leave(previous);
+            audio_stats_producer_blocked(start);
+            continue;
+        }
+        host_audio_mixer_stream_commit(stream->mix, native_audio_fill(&source, dest, frames));
+    }
+    if (file_audio_active) file_audio_pump(false);
+    audio_stats_buffer_written();
+    host_trace_end(HOST_TRACE_AUDIO_GIVE, buffer->sample_count);
+    queue_free_audio_buffer(connection->producer_pool, buffer);
+}
+
+static bool audio_backend_connect(struct audio_buffer_pool *producer_pool) {
+    if (!native_mixer || native_stream_count == PICO_HOST_AUDIO_MAX_STREAMS) return false;
+    struct native_audio_stream *stream = (struct native_audio_stream *) calloc(1, sizeof(struct native_audio_stream));
+    if (!stream) return false;
+    stream->connection = (struct audio_connection) {
+            .consumer_pool_take = consumer_pool_take_buffer_default,
+            .consumer_pool_give = consumer_pool_give_buffer_default,
+            .producer_pool_take = producer_pool_take_buffer_default,
+            .producer_pool_give = audio_backend_producer_pool_give
+    };
+    stream->pipeline = native_audio_create_pipeline(producer_pool);
+    stream->mix = stream->pipeline ? host_audio_mixer_add_stream(native_mixer, native_stream_ring_frames) : NULL;
+    if (!stream->mix) {
+        host_audio_pipeline_destroy(stream->pipeline);
+        free(stream);
+        return false;
+    }
+    native_streams[native_stream_count++] = stream;
+
+    consumer_buffer_format.sample_stride = consumer_format.channel_count * 2;
+    // todo don't need a consumer pool, but have to specify one in current api
+    struct audio_buffer_pool *consumer = audio_new_consumer_pool(&consumer_buffer_format, 0, 0);
+    audio_complete_connection(&stream->connection, producer_pool, consumer);
+    return file_audio_active || native_audio_connect(producer_pool);
+}
+
+static void audio_backend_enable(bool enable) {
+    if (file_audio_active) file_audio_enable(enable);
+    else native_audio_enable(enable);
 }
-#endif
 
 extern const struct audio_format *audio_pwm_setup(const struct audio_format *intended_audio_format, int32_t max_latency_ms,
                     const struct audio_pwm_channel_config *channel_config0, ...)
 {
-    return native_audio_setup(intended_audio_format);
+    return audio_backend_setup(intended_audio_format, max_latency_ms);
 }
 
 bool audio_pwm_default_connect(struct audio_buffer_pool *producer_pool, bool dedicate_core_1) {
-    return native_audio_connect(producer_pool);
+    return audio_backend_connect(producer_pool);
 }
 
 void audio_pwm_set_enabled(bool enabled) {
-    return native_audio_enable(enabled);
+    return audio_backend_enable(enabled);
 }
 
 const struct audio_format *audio_i2s_setup(const struct audio_format *intended_audio_format,
                                                const struct audio_i2s_config *config) {
-    return native_audio_setup(intended_audio_format);
+    return audio_backend_setup(intended_audio_format, -1);
 }
 
 bool audio_i2s_connect(struct audio_buffer_pool *producer_pool) {
-    return native_audio_connect(producer_pool);
+    return audio_backend_connect(producer_pool);
 }
 
 bool audio_i2s_connect_s8(struct audio_buffer_pool *producer_pool) {
-    return native_audio_connect(producer_pool);
+    return audio_backend_connect(producer_pool);
 }
 
 bool audio_i2s_connect_extra(audio_buffer_pool_t *producer_pool, __unused bool buffer_on_give, __unused uint buffer_count,
                              __unused uint samples_per_buffer, __unused audio_connection_t *connection) {
-    return native_audio_connect(producer_pool);
+    return audio_backend_connect(producer_pool);
 }
 
 void audio_i2s_set_enabled(bool enable) {
-    return native_audio_enable(enable);
+    return audio_backend_enable(enable);
 }
 
 bool audio_pwm_set_correction_mode(enum audio_correction_mode mode) {
@@ -491,20 +994,3 @@ bool audio_pwm_set_correction_mode(enum audio_correction_mode mode) {
 enum audio_correction_mode audio_pwm_get_correction_mode() {
     return (enum audio_correction_mode) 0;
 }
-
-#define AUDIO_UPSAMPLE_FRACTION_BITS 12u
-
-void audio_upsample(int16_t *input, int16_t *output, uint output_count, uint32_t step) {
-    uint32_t pos = 0;
-    for (int i = 0; i < output_count; i++) {
-        uint32_t offset = (pos >> AUDIO_UPSAMPLE_FRACTION_BITS);
-        int16_t a = input[offset];
-        int16_t b = input[offset + 1];
-        *output++ = a + (((b - a) * ((pos >> (AUDIO_UPSAMPLE_FRACTION_BITS - 8)) & 0xff)) >> 8);
-        pos += step;
-    }
-}
-
-void audio_upsample_words(int16_t *input, int16_t *output_aligned, uint output_word_count, uint32_t step) {
-    audio_upsample(input, output_aligned, output_word_count * 2, step);
-}
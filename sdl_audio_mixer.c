@@ -0,0 +1,183 @@
+/*
+ * Copyright (c) 2020 Raspberry Pi (Trading) Ltd.
+ *
+ * SPDX-License-Identifier: BSD-3-Clause
+ */
+
+#include <stdatomic.h>
+#include <stdlib.h>
+#include <string.h>
+#include "SDL.h"
+
+#include "pico.h"
+#include "pico/host_audio_mixer.h"
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#define MIXER_SSE2 1
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#define MIXER_NEON 1
+#endif
+
+struct host_audio_mixer_stream {
+    int16_t *ring;
+    uint ring_frames;
+    // count frames ever written/read, so never wrap in practice
+    atomic_uint_fast64_t write_pos;
+    atomic_uint_fast64_t read_pos;
+    // set by the producer about to block on space_sem; the consumer posts it once it has freed some space
+    atomic_bool producer_waiting;
+    SDL_sem *space_sem;
+    struct host_audio_mixer *mixer;
+};
+
+struct host_audio_mixer {
+    uint channels;
+    uint max_streams;
+    atomic_uint stream_count;
+    struct host_audio_mixer_stream *streams;
+    // set by the consumer about to block on data_sem; posted by the next commit
+    atomic_bool consumer_waiting;
+    SDL_sem *data_sem;
+};
+
+struct host_audio_mixer *host_audio_mixer_create(uint channel_count, uint max_streams) {
+    struct host_audio_mixer *mixer = (struct host_audio_mixer *) calloc(1, sizeof(struct host_audio_mixer));
+    if (!mixer) return NULL;
+    mixer->channels = channel_count;
+    mixer->max_streams = max_streams;
+    mixer->streams = (struct host_audio_mixer_stream *) calloc(max_streams, sizeof(struct host_audio_mixer_stream));
+    mixer->data_sem = SDL_CreateSemaphore(0);
+    if (!mixer->streams || !mixer->data_sem) {
+        if (mixer->data_sem) SDL_DestroySemaphore(mixer->data_sem);
+        free(mixer->streams);
+        free(mixer);
+        return NULL;
+    }
+    return mixer;
+}
+
+struct host_audio_mixer_stream *host_audio_mixer_add_stream(struct host_audio_mixer *mixer, uint ring_frames) {
+    uint index = atomic_load(&mixer->stream_count);
+    if (index == mixer->max_streams) return NULL;
+    struct host_audio_mixer_stream *stream = mixer->streams + index;
+    stream->ring = (int16_t *) calloc(ring_frames, mixer->channels * sizeof(int16_t));
+    stream->space_sem = SDL_CreateSemaphore(0);
+    if (!stream->ring || !stream->space_sem) {
+        // leave the slot clean for another attempt
+        if (stream->space_sem) SDL_DestroySemaphore(stream->space_sem);
+        free(stream->ring);
+        stream->space_sem = NULL;
+        stream->ring = NULL;
+        return NULL;
+    }
+    stream->ring_frames = ring_frames;
+    stream->mixer = mixer;
+    // publish the stream to the consumer only once it is set up
+    atomic_store_explicit(&mixer->stream_count, index + 1, memory_order_release);
+    return stream;
+}
+
+int16_t *host_audio_mixer_stream_space(struct host_audio_mixer_stream *stream, uint *frames) {
+    uint64_t write_pos = atomic_load_explicit(&stream->write_pos, memory_order_relaxed);
+    uint64_t used = write_pos - atomic_load_explicit(&stream->read_pos, memory_order_acquire);
+    if (used == stream->ring_frames) return NULL;
+    uint offset = write_pos % stream->ring_frames;
+    *frames = MIN(stream->ring_frames - (uint) used, stream->ring_frames - offset);
+    return stream->ring + offset * stream->mixer->channels;
+}
+
+void host_audio_mixer_stream_commit(struct host_audio_mixer_stream *stream, uint frames) {
+    atomic_fetch_add_explicit(&stream->write_pos, frames, memory_order_release);
+    if (frames && atomic_exchange(&stream->mixer->consumer_waiting, false)) {
+        SDL_SemPost(stream->mixer->data_sem);
+    }
+}
+
+void host_audio_mixer_stream_wait(struct host_audio_mixer_stream *stream) {
+    atomic_store(&stream->producer_waiting, true);
+    // check again, as the consumer may have run between finding the ring full and setting the flag
+    if (atomic_load(&stream->write_pos) - atomic_load(&stream->read_pos) == stream->ring_frames) {
+        SDL_SemWait(stream->space_sem);
+    }
+}
+
+static inline uint stream_queued(struct host_audio_mixer_stream *stream) {
+    return (uint) (atomic_load_explicit(&stream->write_pos, memory_order_acquire) -
+                   atomic_load_explicit(&stream->read_pos, memory_order_relaxed));
+}
+
+uint host_audio_mixer_ready(struct host_audio_mixer *mixer) {
+    uint count = atomic_load_explicit(&mixer->stream_count, memory_order_acquire);
+    uint ready = count ? UINT32_MAX : 0;
+    for (uint i = 0; i < count; i++) ready = MIN(ready, stream_queued(mixer->streams + i));
+    return ready;
+}
+
+uint host_audio_mixer_queued(struct host_audio_mixer *mixer) {
+    uint count = atomic_load_explicit(&mixer->stream_count, memory_order_acquire);
+    uint queued = 0;
+    for (uint i = 0; i < count; i++) queued = MAX(queued, stream_queued(mixer->streams + i));
+    return queued;
+}
+
+void host_audio_mix_s16(int16_t *dst, const int16_t *src, uint samples) {
+    uint i = 0;
+#if MIXER_SSE2
+    for (; i + 8 <= samples; i += 8) {
+        __m128i a = _mm_loadu_si128((const __m128i *) (dst + i));
+        __m128i b = _mm_loadu_si128((const __m128i *) (src + i));
+        _mm_storeu_si128((__m128i *) (dst + i), _mm_adds_epi16(a, b));
+    }
+#elif MIXER_NEON
+    for (; i + 8 <= samples; i += 8) {
+        vst1q_s16(dst + i, vqaddq_s16(vld1q_s16(dst + i), vld1q_s16(src + i)));
+    }
+#endif
+    for (; i < samples; i++) {
+        int32_t v = dst[i] + src[i];
+        dst[i] = (int16_t) MIN(MAX(v, -32768), 32767);
+    }
+}
+
+// the first filled samples of dst already hold earlier streams' audio, so are added to; the rest are copied
+static inline void mix_or_copy(int16_t *dst, const int16_t *src, uint samples, uint filled) {
+    uint n = MIN(samples, filled);
+    host_audio_mix_s16(dst, src, n);
+    memcpy(dst + n, src + n, (samples - n) * sizeof(int16_t));
+}
+
+uint host_audio_mixer_mix(struct host_audio_mixer *mixer, int16_t *out, uint frames) {
+    uint count = atomic_load_explicit(&mixer->stream_count, memory_order_acquire);
+    uint channels = mixer->channels;
+    uint mixed = 0;
+    for (uint i = 0; i < count; i++) {
+        struct host_audio_mixer_stream *stream = mixer->streams + i;
+        uint64_t read_pos = atomic_load_explicit(&stream->read_pos, memory_order_relaxed);
+        uint n = MIN(stream_queued(stream), frames);
+        if (!n) continue;
+        uint offset = read_pos % stream->ring_frames;
+        uint first = MIN(n, stream->ring_frames - offset);
+        mix_or_copy(out, stream->ring + offset * channels, first * channels, mixed * channels);
+        mix_or_copy(out + first * channels, stream->ring, (n - first) * channels,
+                    mixed > first ? (mixed - first) * channels : 0);
+        atomic_store_explicit(&stream->read_pos, read_pos + n, memory_order_release);
+        if (atomic_exchange(&stream->producer_waiting, false)) {
+            SDL_SemPost(stream->space_sem);
+        }
+        mixed = MAX(mixed, n);
+    }
+    memset(out + mixed * channels, 0, (frames - mixed) * channels * sizeof(int16_t));
+    return mixed;
+}
+
+bool host_audio_mixer_wait(struct host_audio_mixer *mixer, uint timeout_ms) {
+    atomic_store(&mixer->consumer_waiting, true);
+    // check again, as a producer may have committed before the flag was set
+    if (host_audio_mixer_queued(mixer)) {
+        atomic_store(&mixer->consumer_waiting, false);
+        return true;
+    }
+    return SDL_SemWaitTimeout(mixer->data_sem, timeout_ms) == 0;
+}
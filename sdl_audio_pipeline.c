@@ -0,0 +1,196 @@
+/*
+ * Copyright (c) 2020 Raspberry Pi (Trading) Ltd.
+ *
+ * SPDX-License-Identifier: BSD-3-Clause
+ */
+
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "pico.h"
+#include "pico/host_audio_pipeline.h"
+#include "pico/host_resampler.h"
+
+// frames converted per pass through the widen and channel map stages
+#define PIPELINE_CHUNK_FRAMES 256
+#define GAIN_FRACTION_BITS 12
+
+typedef void (*widen_fn)(const void *src, int16_t *dst, uint samples);
+typedef void (*map_fn)(const int16_t *src, int16_t *dst, uint frames);
+
+struct host_audio_pipeline {
+    widen_fn widen;
+    map_fn map; // NULL if the channel counts match
+    struct host_resampler *resampler; // NULL if the rates match
+    int32_t gain;
+    uint input_channels;
+    uint input_frame_bytes;
+    uint output_channels;
+    // widened input, when it can't be written straight to the output
+    int16_t *widened;
+    // channel mapped input awaiting the resampler
+    int16_t *pending;
+    uint pending_frames;
+    uint pending_pos;
+};
+
+static void widen_s8(const void *src, int16_t *dst, uint samples) {
+    const uint8_t *s = (const uint8_t *) src;
+    for (uint i = 0; i < samples; i++) dst[i] = (int16_t) (s[i] << 8u);
+}
+
+static void widen_u8(const void *src, int16_t *dst, uint samples) {
+    const uint8_t *s = (const uint8_t *) src;
+    for (uint i = 0; i < samples; i++) dst[i] = (int16_t) ((s[i] ^ 0x80u) << 8u);
+}
+
+static void widen_s16(const void *src, int16_t *dst, uint samples) {
+    memcpy(dst, src, samples * sizeof(int16_t));
+}
+
+static void widen_u16(const void *src, int16_t *dst, uint samples) {
+    const uint16_t *s = (const uint16_t *) src;
+    for (uint i = 0; i < samples; i++) dst[i] = (int16_t) (s[i] ^ 0x8000u);
+}
+
+static void widen_s32(const void *src, int16_t *dst, uint samples) {
+    const int32_t *s = (const int32_t *) src;
+    for (uint i = 0; i < samples; i++) dst[i] = (int16_t) (s[i] >> 16);
+}
+
+static void widen_f32(const void *src, int16_t *dst, uint samples) {
+    const float *s = (const float *) src;
+    for (uint i = 0; i < samples; i++) dst[i] = (int16_t) lrintf(fminf(fmaxf(s[i] * 32768.f, -32768.f), 32767.f));
+}
+
+static void map_mono_to_stereo(const int16_t *src, int16_t *dst, uint frames) {
+    for (uint i = 0; i < frames; i++) {
+        dst[i * 2] = src[i];
+        dst[i * 2 + 1] = src[i];
+    }
+}
+
+static void map_stereo_to_mono(const int16_t *src, int16_t *dst, uint frames) {
+    for (uint i = 0; i < frames; i++) {
+        dst[i] = (int16_t) ((src[i * 2] + src[i * 2 + 1]) >> 1);
+    }
+}
+
+static void apply_gain(int16_t *samples, uint count, int32_t gain) {
+    for (uint i = 0; i < count; i++) {
+        int32_t v = (samples[i] * gain) >> GAIN_FRACTION_BITS;
+        samples[i] = (int16_t) MIN(MAX(v, -32768), 32767);
+    }
+}
+
+struct host_audio_pipeline *host_audio_pipeline_create(const struct host_audio_pipeline_config *config) {
+    static const struct {
+        widen_fn widen;
+        uint bytes;
+    } formats[] = {
+            [HOST_AUDIO_SAMPLE_S8] = {widen_s8, 1},
+            [HOST_AUDIO_SAMPLE_U8] = {widen_u8, 1},
+            [HOST_AUDIO_SAMPLE_S16] = {widen_s16, 2},
+            [HOST_AUDIO_SAMPLE_U16] = {widen_u16, 2},
+            [HOST_AUDIO_SAMPLE_S32] = {widen_s32, 4},
+            [HOST_AUDIO_SAMPLE_F32] = {widen_f32, 4},
+    };
+    if ((uint) config->input_format >= count_of(formats)) return NULL;
+    map_fn map = NULL;
+    if (config->input_channels == 1 && config->output_channels == 2) {
+        map = map_mono_to_stereo;
+    } else if (config->input_channels == 2 && config->output_channels == 1) {
+        map = map_stereo_to_mono;
+    } else if (config->input_channels != config->output_channels || !config->input_channels) {
+        return NULL;
+    }
+    struct host_audio_pipeline *p = (struct host_audio_pipeline *) calloc(1, sizeof(struct host_audio_pipeline));
+    if (!p) return NULL;
+    p->widen = formats[config->input_format].widen;
+    p->map = map;
+    p->gain = 1 << GAIN_FRACTION_BITS;
+    p->input_channels = config->input_channels;
+    p->input_frame_bytes = config->input_channels * formats[config->input_format].bytes;
+    p->output_channels = config->output_channels;
+    p->widened = (int16_t *) malloc(PIPELINE_CHUNK_FRAMES * p->input_channels * sizeof(int16_t));
+    p->pending = (int16_t *) malloc(PIPELINE_CHUNK_FRAMES * p->output_channels * sizeof(int16_t));
+    bool ok = p->widened && p->pending;
+    if (ok && config->input_rate != config->output_rate) {
+        p->resampler = host_resampler_create(config->input_rate, config->output_rate, config->output_channels);
+        ok = p->resampler != NULL;
+    }
+    if (!ok) {
+        host_audio_pipeline_destroy(p);
+        return NULL;
+    }
+    return p;
+}
+
+void host_audio_pipeline_destroy(struct host_audio_pipeline *pipeline) {
+    if (!pipeline) return;
+    host_resampler_destroy(pipeline->resampler);
+    free(pipeline->widened);
+    free(pipeline->pending);
+    free(pipeline);
+}
+
+void host_audio_pipeline_set_gain(struct host_audio_pipeline *pipeline, float gain) {
+    gain = fminf(fmaxf(gain, 0.f), 8.f - 1.f / (1 << GAIN_FRACTION_BITS));
+    pipeline->gain = (int32_t) lrintf(gain * (1 << GAIN_FRACTION_BITS));
+}
+
+bool host_audio_pipeline_is_passthrough(struct host_audio_pipeline *pipeline) {
+    return pipeline->widen == widen_s16 && !pipeline->map && !pipeline->resampler &&
+           pipeline->gain == 1 << GAIN_FRACTION_BITS;
+}
+
+// widen and channel map frames (at most PIPELINE_CHUNK_FRAMES if channel mapping) into dst
+static inline void convert(struct host_audio_pipeline *p, const uint8_t *src, int16_t *dst, uint frames) {
+    if (p->map) {
+        p->widen(src, p->widened, frames * p->input_channels);
+        p->map(p->widened, dst, frames);
+    } else {
+        p->widen(src, dst, frames * p->input_channels);
+    }
+}
+
+uint host_audio_pipeline_process(struct host_audio_pipeline *pipeline, const void *in, uint input_frames,
+                                 uint *input_frames_used, int16_t *out, uint output_frames) {
+    struct host_audio_pipeline *p = pipeline;
+    const uint8_t *src = (const uint8_t *) in;
+    uint produced = 0;
+    uint used = 0;
+    if (!p->resampler) {
+        while (produced < output_frames && used < input_frames) {
+            uint n = MIN(output_frames - produced, input_frames - used);
+            if (p->map) n = MIN(n, PIPELINE_CHUNK_FRAMES);
+            convert(p, src + used * p->input_frame_bytes, out + produced * p->output_channels, n);
+            used += n;
+            produced += n;
+        }
+    } else {
+        while (produced < output_frames) {
+            if (p->pending_pos == p->pending_frames && used < input_frames) {
+                uint n = MIN(PIPELINE_CHUNK_FRAMES, input_frames - used);
+                convert(p, src + used * p->input_frame_bytes, p->pending, n);
+                p->pending_frames = n;
+                p->pending_pos = 0;
+                used += n;
+            }
+            // called even with nothing pending, as the resampler may still have output left from its history
+            uint consumed;
+            uint n = host_resampler_process_s16(p->resampler, p->pending + p->pending_pos * p->output_channels,
+                                                p->pending_frames - p->pending_pos, &consumed,
+                                                out + produced * p->output_channels, output_frames - produced);
+            produced += n;
+            p->pending_pos += consumed;
+            if (!n && p->pending_pos == p->pending_frames && used == input_frames) break;
+        }
+    }
+    if (p->gain != 1 << GAIN_FRACTION_BITS) {
+        apply_gain(out, produced * p->output_channels, p->gain);
+    }
+    *input_frames_used = used;
+    return produced;
+}
@@ -0,0 +1,84 @@
+/*
+ * Copyright (c) 2020 Raspberry Pi (Trading) Ltd.
+ *
+ * SPDX-License-Identifier: BSD-3-Clause
+ */
+
+#include <string.h>
+#include "pico.h"
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#define UPSAMPLE_SSE2 1
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#define UPSAMPLE_NEON 1
+#endif
+
+#define AUDIO_UPSAMPLE_FRACTION_BITS 12u
+
+// the SIMD paths produce exactly the same output as the scalar loop; each output needs the adjacent input pair
+// (a, b) at pos >> AUDIO_UPSAMPLE_FRACTION_BITS, which is loaded as a single 32 bit word
+
+static inline int32_t load_pair(const int16_t *input, uint32_t pos) {
+    int32_t pair;
+    memcpy(&pair, input + (pos >> AUDIO_UPSAMPLE_FRACTION_BITS), sizeof(pair));
+    return pair;
+}
+
+void audio_upsample(int16_t *input, int16_t *output, uint output_count, uint32_t step) {
+    uint32_t pos = 0;
+    uint i = 0;
+#if UPSAMPLE_SSE2
+    const __m128i lane_steps = _mm_set_epi32((int) (3 * step), (int) (2 * step), (int) step, 0);
+    const __m128i frac_mask = _mm_set1_epi32(0xff);
+    for (; i + 8 <= output_count; i += 8) {
+        __m128i result[2];
+        for (int h = 0; h < 2; h++) {
+            __m128i pairs = _mm_set_epi32(load_pair(input, pos + 3 * step), load_pair(input, pos + 2 * step),
+                                          load_pair(input, pos + step), load_pair(input, pos));
+            __m128i frac = _mm_and_si128(_mm_srli_epi32(_mm_add_epi32(_mm_set1_epi32((int) pos), lane_steps),
+                                                        AUDIO_UPSAMPLE_FRACTION_BITS - 8), frac_mask);
+            // (-frac, frac) against (a, b) gives (b - a) * frac in one multiply-add
+            __m128i weights = _mm_or_si128(_mm_slli_epi32(frac, 16),
+                                           _mm_and_si128(_mm_sub_epi32(_mm_setzero_si128(), frac),
+                                                         _mm_set1_epi32(0xffff)));
+            __m128i a = _mm_srai_epi32(_mm_slli_epi32(pairs, 16), 16);
+            result[h] = _mm_add_epi32(a, _mm_srai_epi32(_mm_madd_epi16(pairs, weights), 8));
+            pos += 4 * step;
+        }
+        // results lie between a and b, so never saturate
+        _mm_storeu_si128((__m128i *) (output + i), _mm_packs_epi32(result[0], result[1]));
+    }
+#elif UPSAMPLE_NEON
+    const uint32_t lane_step_values[4] = {0, step, 2 * step, 3 * step};
+    const uint32x4_t lane_steps = vld1q_u32(lane_step_values);
+    for (; i + 8 <= output_count; i += 8) {
+        int16x4_t result[2];
+        for (int h = 0; h < 2; h++) {
+            int32_t pair_values[4] = {load_pair(input, pos), load_pair(input, pos + step),
+                                      load_pair(input, pos + 2 * step), load_pair(input, pos + 3 * step)};
+            int32x4_t pairs = vld1q_s32(pair_values);
+            int32x4_t frac = vreinterpretq_s32_u32(vandq_u32(
+                    vshrq_n_u32(vaddq_u32(vdupq_n_u32(pos), lane_steps), AUDIO_UPSAMPLE_FRACTION_BITS - 8),
+                    vdupq_n_u32(0xff)));
+            int32x4_t a = vshrq_n_s32(vshlq_n_s32(pairs, 16), 16);
+            int32x4_t b = vshrq_n_s32(pairs, 16);
+            result[h] = vmovn_s32(vaddq_s32(a, vshrq_n_s32(vmulq_s32(vsubq_s32(b, a), frac), 8)));
+            pos += 4 * step;
+        }
+        vst1q_s16(output + i, vcombine_s16(result[0], result[1]));
+    }
+#endif
+    for (; i < output_count; i++) {
+        uint32_t offset = (pos >> AUDIO_UPSAMPLE_FRACTION_BITS);
+        int16_t a = input[offset];
+        int16_t b = input[offset + 1];
+        output[i] = a + (((b - a) * ((pos >> (AUDIO_UPSAMPLE_FRACTION_BITS - 8)) & 0xff)) >> 8);
+        pos += step;
+    }
+}
+
+void audio_upsample_words(int16_t *input, int16_t *output_aligned, uint output_word_count, uint32_t step) {
+    audio_upsample(input, output_aligned, output_word_count * 2, step);
+}
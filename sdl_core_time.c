@@ -0,0 +1,184 @@
+/*
+ * Copyright (c) 2020 Raspberry Pi (Trading) Ltd.
+ *
+ * SPDX-License-Identifier: BSD-3-Clause
+ */
+
+#include <assert.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <string.h>
+#ifdef __linux__
+#include <pthread.h>
+#include <time.h>
+#define CORE_TIME_CPU_CLOCK 1
+#else
+#define CORE_TIME_CPU_CLOCK 0
+#endif
+#include "SDL.h"
+
+#include "pico.h"
+#include "pico/host_core_time.h"
+
+static const char *const state_names[HOST_CORE_TIME_STATE_COUNT] = {
+        "busy", "wfe", "tight loop", "semaphore", "spin lock", "audio blocked",
+};
+
+// per core; busy time isn't accumulated, it is whatever remains of the total
+static atomic_uint_fast64_t wait_wall_ns[NUM_CORES][HOST_CORE_TIME_STATE_COUNT];
+static atomic_uint_fast64_t wait_cpu_ns[NUM_CORES][HOST_CORE_TIME_STATE_COUNT];
+static atomic_bool core_running[NUM_CORES];
+// the totals at startup or the last reset
+static atomic_uint_fast64_t base_wall_ns[NUM_CORES];
+static atomic_uint_fast64_t base_cpu_ns[NUM_CORES];
+
+// HOST_CORE_TIME_STATE_COUNT on threads which aren't accounted
+static _Thread_local enum host_core_time_state thread_state = HOST_CORE_TIME_STATE_COUNT;
+static _Thread_local uint thread_core;
+static _Thread_local uint64_t thread_wall_mark, thread_cpu_mark;
+
+static uint64_t wall_ns(void) {
+    uint64_t ticks = SDL_GetPerformanceCounter(), freq = SDL_GetPerformanceFrequency();
+    return ticks / freq * 1000000000ull + ticks % freq * 1000000000ull / freq;
+}
+
+#if CORE_TIME_CPU_CLOCK
+static clockid_t core_cpu_clock[NUM_CORES];
+
+static uint64_t clock_ns(clockid_t clock) {
+    struct timespec ts;
+    // fails for the CPU clock of a thread which has exited
+    if (clock_gettime(clock, &ts)) return 0;
+    return ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+static void core_cpu_clock_init(uint core) {
+    if (pthread_getcpuclockid(pthread_self(), &core_cpu_clock[core])) core_cpu_clock[core] = CLOCK_THREAD_CPUTIME_ID;
+}
+
+static uint64_t thread_cpu_ns(void) {
+    return clock_ns(CLOCK_THREAD_CPUTIME_ID);
+}
+
+// the thread's CPU clock may be read from any thread
+static uint64_t core_cpu_ns(uint core) {
+    return clock_ns(core_cpu_clock[core]);
+}
+#else
+// no thread CPU clock which another thread can read, so only wall clock time is accounted
+static void core_cpu_clock_init(uint core) {
+}
+
+static uint64_t thread_cpu_ns(void) {
+    return 0;
+}
+
+static uint64_t core_cpu_ns(uint core) {
+    return 0;
+}
+#endif
+
+void host_core_time_thread_start(uint core) {
+    assert(core < NUM_CORES);
+    thread_core = core;
+    thread_state = HOST_CORE_TIME_BUSY;
+    core_cpu_clock_init(core);
+    atomic_store(&base_wall_ns[core], wall_ns());
+    atomic_store(&base_cpu_ns[core], core_cpu_ns(core));
+    atomic_store(&core_running[core], true);
+}
+
+enum host_core_time_state host_core_time_enter(enum host_core_time_state state) {
+    enum host_core_time_state previous = thread_state;
+    if (previous == HOST_CORE_TIME_BUSY) {
+        thread_state = state;
+        thread_wall_mark = wall_ns();
+        thread_cpu_mark = thread_cpu_ns();
+    }
+    return previous;
+}
+
+void host_core_time_leave(enum host_core_time_state previous) {
+    if (previous != HOST_CORE_TIME_BUSY) return;
+    uint64_t wall = wall_ns() - thread_wall_mark;
+    uint64_t cpu = thread_cpu_ns() - thread_cpu_mark;
+    atomic_fetch_add_explicit(&wait_wall_ns[thread_core][thread_state], wall, memory_order_relaxed);
+    atomic_fetch_add_explicit(&wait_cpu_ns[thread_core][thread_state], cpu, memory_order_relaxed);
+    thread_state = HOST_CORE_TIME_BUSY;
+}
+
+void host_core_time_get(uint core, struct host_core_time *time) {
+    assert(core < NUM_CORES);
+    memset(time, 0, sizeof(*time));
+    time->running = atomic_load(&core_running[core]);
+    if (!time->running) return;
+    uint64_t wall = wall_ns() - atomic_load(&base_wall_ns[core]);
+    uint64_t cpu = core_cpu_ns(core);
+    cpu = cpu > atomic_load(&base_cpu_ns[core]) ? cpu - atomic_load(&base_cpu_ns[core]) : 0;
+    uint64_t waited_wall = 0, waited_cpu = 0;
+    for (int s = HOST_CORE_TIME_BUSY + 1; s < HOST_CORE_TIME_STATE_COUNT; s++) {
+        uint64_t w = atomic_load_explicit(&wait_wall_ns[core][s], memory_order_relaxed);
+        uint64_t c = atomic_load_explicit(&wait_cpu_ns[core][s], memory_order_relaxed);
+        time->wall_us[s] = w / 1000;
+        time->cpu_us[s] = c / 1000;
+        waited_wall += w;
+        waited_cpu += c;
+    }
+    time->wall_us[HOST_CORE_TIME_BUSY] = wall > waited_wall ? (wall - waited_wall) / 1000 : 0;
+    time->cpu_us[HOST_CORE_TIME_BUSY] = cpu > waited_cpu ? (cpu - waited_cpu) / 1000 : 0;
+}
+
+void host_core_time_reset(void) {
+    for (int core = 0; core < NUM_CORES; core++) {
+        if (!atomic_load(&core_running[core])) continue;
+        atomic_store(&base_wall_ns[core], wall_ns());
+        atomic_store(&base_cpu_ns[core], core_cpu_ns(core));
+        for (int s = 0; s < HOST_CORE_TIME_STATE_COUNT; s++) {
+            atomic_store(&wait_wall_ns[core][s], 0);
+            atomic_store(&wait_cpu_ns[core][s], 0);
+        }
+    }
+}
+
+static Uint32 core_time_log(Uint32 interval, void *param) {
+    static struct host_core_time last[NUM_CORES];
+    for (uint core = 0; core < NUM_CORES; core++) {
+        struct host_core_time time;
+        host_core_time_get(core, &time);
+        if (!time.running) continue;
+        uint64_t wall = 0, last_wall = 0;
+        for (int s = 0; s < HOST_CORE_TIME_STATE_COUNT; s++) {
+            wall += time.wall_us[s];
+            last_wall += last[core].wall_us[s];
+        }
+        // start over after a reset
+        if (wall < last_wall) memset(&last[core], 0, sizeof(last[core]));
+        uint64_t cpu = 0;
+        wall = 0;
+        for (int s = 0; s < HOST_CORE_TIME_STATE_COUNT; s++) {
+            wall += time.wall_us[s] - last[core].wall_us[s];
+            cpu += time.cpu_us[s] - last[core].cpu_us[s];
+        }
+        char line[256];
+#if CORE_TIME_CPU_CLOCK
+        int pos = snprintf(line, sizeof(line), "Core %u: CPU %.1f%%", core, wall ? 100.0 * cpu / wall : 0.0);
+#else
+        int pos = snprintf(line, sizeof(line), "Core %u: CPU n/a", core);
+#endif
+        for (int s = 0; s < HOST_CORE_TIME_STATE_COUNT && pos < (int) sizeof(line); s++) {
+            // busy time shrinks when a long wait finishes, so may appear to go backwards
+            int64_t w = MAX(0, (int64_t) (time.wall_us[s] - last[core].wall_us[s]));
+            if (s == HOST_CORE_TIME_BUSY || w) {
+                pos += snprintf(line + pos, sizeof(line) - pos, ", %s %.1f%%", state_names[s], wall ? 100.0 * w / wall : 0.0);
+            }
+        }
+        printf("%s\n", line);
+        last[core] = time;
+    }
+    return interval;
+}
+
+void host_core_time_start_log(uint32_t interval_ms) {
+    static SDL_TimerID timer;
+    if (!timer && interval_ms) timer = SDL_AddTimer(interval_ms, core_time_log, NULL);
+}
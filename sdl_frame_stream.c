@@ -0,0 +1,397 @@
+/*
+ * Copyright (c) 2020 Raspberry Pi (Trading) Ltd.
+ *
+ * SPDX-License-Identifier: BSD-3-Clause
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "SDL_atomic.h"
+#include "SDL_mutex.h"
+#include "SDL_thread.h"
+
+#include "pico.h"
+#include "pico/scanvideo.h"
+#include "pico/host_frame_stream.h"
+#include "sdl_le.h"
+
+#ifndef _WIN32
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#ifndef PICO_HOST_FRAME_STREAM_MAX_CLIENTS
+#define PICO_HOST_FRAME_STREAM_MAX_CLIENTS 8
+#endif
+
+// number of messages which may be waiting to be sent to a single client before frames are dropped
+#ifndef PICO_HOST_FRAME_STREAM_CLIENT_QUEUE_LENGTH
+#define PICO_HOST_FRAME_STREAM_CLIENT_QUEUE_LENGTH 3
+#endif
+
+#define FRAME_STREAM_HEADER_BYTES 20
+
+#ifdef MSG_NOSIGNAL
+#define FRAME_STREAM_SEND_FLAGS MSG_NOSIGNAL
+#else
+#define FRAME_STREAM_SEND_FLAGS 0
+#endif
+
+// messages are only ever touched by the server thread, so the reference count needs no locking
+struct frame_stream_msg {
+    int refs;
+    uint32_t size;
+    uint8_t data[];
+};
+
+struct frame_stream_client {
+    int fd;
+    bool need_key_frame;
+    uint queue_head;
+    uint queue_count;
+    uint32_t sent; // bytes of the message at queue_head already sent
+    struct frame_stream_msg *queue[PICO_HOST_FRAME_STREAM_CLIENT_QUEUE_LENGTH];
+};
+
+static int listen_fd = -1;
+static int wake_fds[2] = {-1, -1};
+static struct frame_stream_client clients[PICO_HOST_FRAME_STREAM_MAX_CLIENTS];
+static SDL_atomic_t client_count;
+
+// frame handed over by the video code; protected by staging_mutex
+static SDL_mutex *staging_mutex;
+static uint16_t *staging_pixels;
+static uint staging_width, staging_height;
+static uint32_t staging_frame_number;
+static bool staging_valid;
+
+// owned by the server thread
+static uint16_t *current_pixels, *previous_pixels;
+static uint frame_width, frame_height;
+static uint32_t frame_number;
+static uint8_t *encode_buffer;
+
+static inline uint16_t scanvideo_pixel_to_rgb565(uint16_t p) {
+    uint r = (p >> PICO_SCANVIDEO_PIXEL_RSHIFT) & 0x1fu;
+    uint g = (p >> PICO_SCANVIDEO_PIXEL_GSHIFT) & 0x1fu;
+    uint b = (p >> PICO_SCANVIDEO_PIXEL_BSHIFT) & 0x1fu;
+    return (uint16_t) ((r << 11u) | (g << 6u) | ((g >> 4u) << 5u) | b);
+}
+
+static size_t max_message_size(uint width, uint height) {
+    // worst case every pixel is its own run
+    return FRAME_STREAM_HEADER_BYTES + height * (4 + width * 4);
+}
+
+static struct frame_stream_msg *encode_frame(bool key_frame) {
+    uint8_t *p = encode_buffer + FRAME_STREAM_HEADER_BYTES;
+    uint row_count = 0;
+    for (uint y = 0; y < frame_height; y++) {
+        const uint16_t *row = current_pixels + y * frame_width;
+        if (!key_frame && !memcmp(row, previous_pixels + y * frame_width, frame_width * sizeof(uint16_t))) {
+            continue;
+        }
+        put_le(&p, y, 2);
+        uint8_t *run_count_pos = p;
+        p += 2;
+        uint run_count = 0;
+        for (uint x = 0; x < frame_width;) {
+            uint16_t c = row[x];
+            uint len = 1;
+            while (x + len < frame_width && row[x + len] == c && len < 0xffff) len++;
+            put_le(&p, len, 2);
+            put_le(&p, scanvideo_pixel_to_rgb565(c), 2);
+            run_count++;
+            x += len;
+        }
+        put_le(&run_count_pos, run_count, 2);
+        row_count++;
+    }
+    if (!key_frame && !row_count) return NULL;
+    uint32_t size = (uint32_t) (p - encode_buffer);
+    p = encode_buffer;
+    put_le(&p, PICO_HOST_FRAME_STREAM_MAGIC, 4);
+    put_le(&p, key_frame ? PICO_HOST_FRAME_STREAM_KEY_FRAME : PICO_HOST_FRAME_STREAM_DELTA_FRAME, 1);
+    put_le(&p, 0, 1);
+    put_le(&p, frame_width, 2);
+    put_le(&p, frame_height, 2);
+    put_le(&p, row_count, 2);
+    put_le(&p, frame_number, 4);
+    put_le(&p, size - FRAME_STREAM_HEADER_BYTES, 4);
+    struct frame_stream_msg *msg = malloc(sizeof(struct frame_stream_msg) + size);
+    if (!msg) return NULL;
+    msg->refs = 0;
+    msg->size = size;
+    memcpy(msg->data, encode_buffer, size);
+    return msg;
+}
+
+static void release_msg(struct frame_stream_msg *msg) {
+    if (!--msg->refs) free(msg);
+}
+
+static bool client_enqueue(struct frame_stream_client *client, struct frame_stream_msg *msg) {
+    if (client->queue_count == PICO_HOST_FRAME_STREAM_CLIENT_QUEUE_LENGTH) return false;
+    client->queue[(client->queue_head + client->queue_count++) % PICO_HOST_FRAME_STREAM_CLIENT_QUEUE_LENGTH] = msg;
+    msg->refs++;
+    return true;
+}
+
+static void client_close(struct frame_stream_client *client) {
+    while (client->queue_count) {
+        release_msg(client->queue[client->queue_head]);
+        client->queue_head = (client->queue_head + 1) % PICO_HOST_FRAME_STREAM_CLIENT_QUEUE_LENGTH;
+        client->queue_count--;
+    }
+    close(client->fd);
+    client->fd = -1;
+    SDL_AtomicAdd(&client_count, -1);
+}
+
+static void client_send(struct frame_stream_client *client) {
+    while (client->queue_count) {
+        struct frame_stream_msg *msg = client->queue[client->queue_head];
+        ssize_t n = send(client->fd, msg->data + client->sent, msg->size - client->sent, FRAME_STREAM_SEND_FLAGS);
+        if (n < 0) {
+            if (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR) return;
+            client_close(client);
+            return;
+        }
+        client->sent += (uint32_t) n;
+        if (client->sent < msg->size) return;
+        client->sent = 0;
+        release_msg(msg);
+        client->queue_head = (client->queue_head + 1) % PICO_HOST_FRAME_STREAM_CLIENT_QUEUE_LENGTH;
+        client->queue_count--;
+    }
+}
+
+static void accept_client(void) {
+    int fd = accept(listen_fd, NULL, NULL);
+    if (fd < 0) return;
+    for (int i = 0; i < PICO_HOST_FRAME_STREAM_MAX_CLIENTS; i++) {
+        if (clients[i].fd < 0) {
+            fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+#ifdef SO_NOSIGPIPE
+            int one = 1;
+            setsockopt(fd, SOL_SOCKET, SO_NOSIGPIPE, &one, sizeof(one));
+#endif
+            clients[i] = (struct frame_stream_client) {
+                    .fd = fd,
+                    .need_key_frame = true,
+            };
+            SDL_AtomicAdd(&client_count, 1);
+            return;
+        }
+    }
+    printf("Frame stream: too many clients\n");
+    close(fd);
+}
+
+static bool take_staged_frame(void) {
+    SDL_LockMutex(staging_mutex);
+    bool valid = staging_valid;
+    if (valid) {
+        if (staging_width != frame_width || staging_height != frame_height) {
+            free(current_pixels);
+            free(previous_pixels);
+            free(encode_buffer);
+            frame_width = staging_width;
+            frame_height = staging_height;
+            current_pixels = calloc(frame_width * frame_height, sizeof(uint16_t));
+            previous_pixels = calloc(frame_width * frame_height, sizeof(uint16_t));
+            encode_buffer = malloc(max_message_size(frame_width, frame_height));
+            // deltas against a different size are meaningless
+            for (int i = 0; i < PICO_HOST_FRAME_STREAM_MAX_CLIENTS; i++) clients[i].need_key_frame = true;
+            if (!current_pixels || !previous_pixels || !encode_buffer) {
+                // drop the frame; the next one of this size tries again
+                free(current_pixels);
+                free(previous_pixels);
+                free(encode_buffer);
+                current_pixels = previous_pixels = NULL;
+                encode_buffer = NULL;
+                frame_width = frame_height = 0;
+                staging_valid = false;
+                SDL_UnlockMutex(staging_mutex);
+                return false;
+            }
+        }
+        uint16_t *tmp = previous_pixels;
+        previous_pixels = current_pixels;
+        current_pixels = staging_pixels;
+        staging_pixels = tmp;
+        frame_number = staging_frame_number;
+        staging_valid = false;
+    }
+    SDL_UnlockMutex(staging_mutex);
+    return valid;
+}
+
+static void distribute_frame(void) {
+    struct frame_stream_msg *delta = NULL, *key = NULL;
+    bool delta_encoded = false;
+    for (int i = 0; i < PICO_HOST_FRAME_STREAM_MAX_CLIENTS; i++) {
+        struct frame_stream_client *client = &clients[i];
+        if (client->fd < 0) continue;
+        if (client->queue_count == PICO_HOST_FRAME_STREAM_CLIENT_QUEUE_LENGTH) {
+            // slow client; drop this frame, and resync with a key frame once it has caught up
+            client->need_key_frame = true;
+            continue;
+        }
+        if (client->need_key_frame) {
+            if (!key) key = encode_frame(true);
+            if (key && client_enqueue(client, key)) client->need_key_frame = false;
+        } else {
+            if (!delta_encoded) {
+                delta = encode_frame(false);
+                delta_encoded = true;
+            }
+            if (delta) client_enqueue(client, delta);
+        }
+    }
+    // free any message which no client took
+    if (key && !key->refs) free(key);
+    if (delta && !delta->refs) free(delta);
+}
+
+static int frame_stream_thread_func(void *data) {
+    struct pollfd fds[PICO_HOST_FRAME_STREAM_MAX_CLIENTS + 2];
+    while (true) {
+        fds[0] = (struct pollfd) {.fd = listen_fd, .events = POLLIN};
+        fds[1] = (struct pollfd) {.fd = wake_fds[0], .events = POLLIN};
+        for (int i = 0; i < PICO_HOST_FRAME_STREAM_MAX_CLIENTS; i++) {
+            fds[i + 2] = (struct pollfd) {
+                    .fd = clients[i].fd,
+                    .events = clients[i].queue_count ? POLLOUT : 0,
+            };
+        }
+        if (poll(fds, count_of(fds), -1) < 0) {
+            if (errno == EINTR) continue;
+            printf("Frame stream: poll failed: %s\n", strerror(errno));
+            return 1;
+        }
+        if (fds[1].revents & POLLIN) {
+            char buf[64];
+            while (read(wake_fds[0], buf, sizeof(buf)) > 0);
+            if (take_staged_frame()) distribute_frame();
+        }
+        for (int i = 0; i < PICO_HOST_FRAME_STREAM_MAX_CLIENTS; i++) {
+            if (clients[i].fd < 0) continue;
+            if (fds[i + 2].revents & (POLLERR | POLLHUP | POLLNVAL)) {
+                client_close(&clients[i]);
+            } else {
+                client_send(&clients[i]);
+            }
+        }
+        if (fds[0].revents & POLLIN) accept_client();
+    }
+}
+
+static int open_listen_socket(const char *address) {
+    int fd;
+    if (!strncmp(address, "unix:", 5)) {
+        struct sockaddr_un addr;
+        memset(&addr, 0, sizeof(addr));
+        addr.sun_family = AF_UNIX;
+        if (strlen(address + 5) >= sizeof(addr.sun_path)) return -1;
+        strcpy(addr.sun_path, address + 5);
+        unlink(addr.sun_path);
+        fd = socket(AF_UNIX, SOCK_STREAM, 0);
+        if (fd >= 0 && bind(fd, (struct sockaddr *) &addr, sizeof(addr)) < 0) {
+            close(fd);
+            return -1;
+        }
+    } else if (!strncmp(address, "tcp:", 4)) {
+        struct sockaddr_in addr;
+        memset(&addr, 0, sizeof(addr));
+        addr.sin_family = AF_INET;
+        addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        addr.sin_port = htons((uint16_t) atoi(address + 4));
+        fd = socket(AF_INET, SOCK_STREAM, 0);
+        int one = 1;
+        if (fd >= 0) setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+        if (fd >= 0 && bind(fd, (struct sockaddr *) &addr, sizeof(addr)) < 0) {
+            close(fd);
+            return -1;
+        }
+    } else {
+        return -1;
+    }
+    if (fd >= 0 && listen(fd, PICO_HOST_FRAME_STREAM_MAX_CLIENTS) < 0) {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+bool frame_stream_start(const char *address) {
+    if (listen_fd >= 0) return false;
+    listen_fd = open_listen_socket(address);
+    if (listen_fd < 0) {
+        printf("Frame stream: unable to listen on '%s'\n", address);
+        return false;
+    }
+    if (pipe(wake_fds) < 0) {
+        close(listen_fd);
+        listen_fd = -1;
+        return false;
+    }
+    fcntl(wake_fds[0], F_SETFL, fcntl(wake_fds[0], F_GETFL) | O_NONBLOCK);
+    fcntl(wake_fds[1], F_SETFL, fcntl(wake_fds[1], F_GETFL) | O_NONBLOCK);
+    for (int i = 0; i < PICO_HOST_FRAME_STREAM_MAX_CLIENTS; i++) clients[i].fd = -1;
+    staging_mutex = SDL_CreateMutex();
+    SDL_CreateThread(frame_stream_thread_func, "Frame stream", NULL);
+    printf("Frame stream: listening on '%s'\n", address);
+    return true;
+}
+
+uint frame_stream_get_client_count(void) {
+    return (uint) SDL_AtomicGet(&client_count);
+}
+
+void frame_stream_submit_frame(const uint16_t *pixels, uint pitch, uint width, uint height, uint32_t number) {
+    if (!SDL_AtomicGet(&client_count)) return;
+    SDL_LockMutex(staging_mutex);
+    if (width != staging_width || height != staging_height) {
+        free(staging_pixels);
+        staging_pixels = calloc(width * height, sizeof(uint16_t));
+        if (!staging_pixels) {
+            staging_width = staging_height = 0;
+            staging_valid = false;
+            SDL_UnlockMutex(staging_mutex);
+            return;
+        }
+        staging_width = width;
+        staging_height = height;
+    }
+    for (uint y = 0; y < height; y++) {
+        memcpy(staging_pixels + y * width, (const uint8_t *) pixels + y * pitch, width * sizeof(uint16_t));
+    }
+    staging_frame_number = number;
+    staging_valid = true;
+    SDL_UnlockMutex(staging_mutex);
+    char c = 0;
+    __unused ssize_t rc = write(wake_fds[1], &c, 1);
+}
+
+#else
+
+bool frame_stream_start(const char *address) {
+    printf("Frame stream: not supported on this platform\n");
+    return false;
+}
+
+uint frame_stream_get_client_count(void) {
+    return 0;
+}
+
+void frame_stream_submit_frame(const uint16_t *pixels, uint pitch, uint width, uint height, uint32_t number) {
+}
+
+#endif
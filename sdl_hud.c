@@ -0,0 +1,153 @@
+/*
+ * Copyright (c) 2020 Raspberry Pi (Trading) Ltd.
+ *
+ * SPDX-License-Identifier: BSD-3-Clause
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include "SDL.h"
+
+#include "pico.h"
+#include "pico/host_video.h"
+
+// Performance overlay drawn with renderer primitives on top of the scaled output (so pico_access_surface is never
+// touched). Everything drawn is bounded by HUD_HISTORY and the fixed set of graphs.
+
+#define HUD_HISTORY 128
+#define HUD_GRAPH_HEIGHT 24
+#define HUD_LABEL_WIDTH 44
+#define HUD_MARGIN 4
+#define HUD_GRAPH_COUNT (3 + NUM_CORES)
+
+float (*host_video_audio_queue_fill_fn)(void);
+
+volatile bool hud_enabled;
+
+// one sample per generated frame; written by whichever core starts a new frame, read by the render thread
+static float history[HUD_GRAPH_COUNT][HUD_HISTORY];
+static SDL_atomic_t history_pos;
+
+static uint64_t last_frame_ticks;
+static uint64_t last_wfe_ticks[NUM_CORES];
+
+void hud_record_frame(uint late_scanlines, const uint64_t *wfe_ticks) {
+    if (!hud_enabled) {
+        last_frame_ticks = 0;
+        return;
+    }
+    uint64_t now = SDL_GetPerformanceCounter();
+    if (last_frame_ticks) {
+        double elapsed = (double) (now - last_frame_ticks);
+        int pos = SDL_AtomicGet(&history_pos) % HUD_HISTORY;
+        history[0][pos] = (float) (SDL_GetPerformanceFrequency() / elapsed);
+        history[1][pos] = (float) late_scanlines;
+        history[2][pos] = host_video_audio_queue_fill_fn ? host_video_audio_queue_fill_fn() : 0.f;
+        for (int i = 0; i < NUM_CORES; i++) {
+            history[3 + i][pos] = (float) ((wfe_ticks[i] - last_wfe_ticks[i]) / elapsed);
+        }
+        SDL_AtomicAdd(&history_pos, 1);
+    }
+    last_frame_ticks = now;
+    memcpy(last_wfe_ticks, wfe_ticks, sizeof(last_wfe_ticks));
+}
+
+// 3x5 glyphs, one bit per pixel, top row in the high bits
+static uint16_t glyph_bits(char c) {
+    switch (c) {
+        case '0': return 075557;
+        case '1': return 026227;
+        case '2': return 071747;
+        case '3': return 071717;
+        case '4': return 055711;
+        case '5': return 074717;
+        case '6': return 074757;
+        case '7': return 071111;
+        case '8': return 075757;
+        case '9': return 075717;
+        case '.': return 000002;
+        case '%': return 051245;
+        case 'A': return 025755;
+        case 'D': return 065556;
+        case 'E': return 074647;
+        case 'F': return 074644;
+        case 'H': return 055755;
+        case 'L': return 044447;
+        case 'T': return 072222;
+        case 'U': return 055557;
+        case 'W': return 055575;
+        case 'Z': return 071247;
+        default: return 0;
+    }
+}
+
+static void draw_text(SDL_Renderer *renderer, int x, int y, const char *text) {
+    static SDL_Rect rects[16 * 15];
+    int n = 0;
+    for (int i = 0; text[i] && i < 16; i++) {
+        uint16_t bits = glyph_bits(text[i]);
+        for (int b = 0; b < 15; b++) {
+            if (bits & (1u << (14 - b))) {
+                rects[n++] = (SDL_Rect) {x + i * 8 + (b % 3) * 2, y + (b / 3) * 2, 2, 2};
+            }
+        }
+    }
+    if (n) SDL_RenderFillRects(renderer, rects, n);
+}
+
+static void draw_graph(SDL_Renderer *renderer, int x, int y, const float *values, int pos, float max,
+                       const char *label, const char *format, float value_scale) {
+    static SDL_Point points[HUD_HISTORY];
+    if (max <= 0) {
+        for (int i = 0; i < HUD_HISTORY; i++) if (values[i] > max) max = values[i];
+        if (max <= 0) max = 1;
+    }
+    for (int i = 0; i < HUD_HISTORY; i++) {
+        float v = values[(pos + i) % HUD_HISTORY] / max;
+        if (v > 1) v = 1;
+        points[i] = (SDL_Point) {x + HUD_LABEL_WIDTH + i, y + HUD_GRAPH_HEIGHT - 1 - (int) (v * (HUD_GRAPH_HEIGHT - 1))};
+    }
+    SDL_RenderDrawLines(renderer, points, HUD_HISTORY);
+    char buf[16];
+    draw_text(renderer, x, y, label);
+    snprintf(buf, sizeof(buf), format, values[(pos + HUD_HISTORY - 1) % HUD_HISTORY] * value_scale);
+    draw_text(renderer, x, y + 12, buf);
+}
+
+void hud_draw(SDL_Renderer *renderer) {
+    if (!hud_enabled) return;
+    int pos = SDL_AtomicGet(&history_pos) % HUD_HISTORY;
+    // draw in output pixels rather than the (possibly very large) logical size used for the picture
+    int logical_width, logical_height;
+    SDL_RenderGetLogicalSize(renderer, &logical_width, &logical_height);
+    SDL_RenderSetLogicalSize(renderer, 0, 0);
+    int output_width, output_height;
+    SDL_GetRendererOutputSize(renderer, &output_width, &output_height);
+    float scale = output_height >= 960 ? 2.f : 1.f;
+    SDL_RenderSetScale(renderer, scale, scale);
+    SDL_SetRenderDrawBlendMode(renderer, SDL_BLENDMODE_BLEND);
+    SDL_SetRenderDrawColor(renderer, 0, 0, 0, 160);
+    SDL_Rect panel = {HUD_MARGIN, HUD_MARGIN, HUD_LABEL_WIDTH + HUD_HISTORY + 2 * HUD_MARGIN,
+                      HUD_GRAPH_COUNT * (HUD_GRAPH_HEIGHT + HUD_MARGIN) + HUD_MARGIN};
+    SDL_RenderFillRect(renderer, &panel);
+    SDL_SetRenderDrawBlendMode(renderer, SDL_BLENDMODE_NONE);
+    int x = 2 * HUD_MARGIN;
+    int y = 2 * HUD_MARGIN;
+    SDL_SetRenderDrawColor(renderer, 64, 255, 64, 255);
+    draw_graph(renderer, x, y, history[0], pos, 0, "HZ", "%.1f", 1);
+    y += HUD_GRAPH_HEIGHT + HUD_MARGIN;
+    SDL_SetRenderDrawColor(renderer, 255, 96, 64, 255);
+    draw_graph(renderer, x, y, history[1], pos, 0, "LATE", "%.0f", 1);
+    y += HUD_GRAPH_HEIGHT + HUD_MARGIN;
+    SDL_SetRenderDrawColor(renderer, 96, 160, 255, 255);
+    draw_graph(renderer, x, y, history[2], pos, 1, "AUD%", "%.0f", 100);
+    for (int i = 0; i < NUM_CORES; i++) {
+        char label[8];
+        snprintf(label, sizeof(label), "WFE%d", i);
+        y += HUD_GRAPH_HEIGHT + HUD_MARGIN;
+        SDL_SetRenderDrawColor(renderer, 255, 224, 64, 255);
+        draw_graph(renderer, x, y, history[3 + i], pos, 1, label, "%.0f%%", 100);
+    }
+    SDL_RenderSetScale(renderer, 1.f, 1.f);
+    if (logical_width && logical_height) SDL_RenderSetLogicalSize(renderer, logical_width, logical_height);
+}
@@ -0,0 +1,25 @@
+/*
+ * Copyright (c) 2020 Raspberry Pi (Trading) Ltd.
+ *
+ * SPDX-License-Identifier: BSD-3-Clause
+ */
+
+#ifndef _SDL_LE_H
+#define _SDL_LE_H
+
+// Little endian values for the host's file and socket formats (scanline recordings, WAV headers and the frame
+// stream), written at or read from *p, which is advanced past them. Internal to this library and its bench programs
+
+#include "pico.h"
+
+static inline void put_le(uint8_t **p, uint32_t value, uint bytes) {
+    for (uint i = 0; i < bytes; i++) *(*p)++ = (uint8_t) (value >> (8 * i));
+}
+
+static inline uint32_t get_le(const uint8_t **p, uint bytes) {
+    uint32_t value = 0;
+    for (uint i = 0; i < bytes; i++) value |= (uint32_t) *(*p)++ << (8 * i);
+    return value;
+}
+
+#endif
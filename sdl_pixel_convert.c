@@ -0,0 +1,169 @@
+/*
+ * Copyright (c) 2020 Raspberry Pi (Trading) Ltd.
+ *
+ * SPDX-License-Identifier: BSD-3-Clause
+ */
+
+#include <assert.h>
+#include "pico.h"
+#include "pico/scanvideo.h"
+#include "pico/host_pixel_convert.h"
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#define CONVERT_SSE2 1
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#define CONVERT_NEON 1
+#endif
+
+#ifndef PICO_SCANVIDEO_PIXEL_RCOUNT
+#define PICO_SCANVIDEO_PIXEL_RCOUNT 5
+#endif
+#ifndef PICO_SCANVIDEO_PIXEL_GCOUNT
+#define PICO_SCANVIDEO_PIXEL_GCOUNT 5
+#endif
+#ifndef PICO_SCANVIDEO_PIXEL_BCOUNT
+#define PICO_SCANVIDEO_PIXEL_BCOUNT 5
+#endif
+
+static_assert(PICO_SCANVIDEO_PIXEL_RCOUNT >= 4 && PICO_SCANVIDEO_PIXEL_RCOUNT <= 8, "");
+static_assert(PICO_SCANVIDEO_PIXEL_GCOUNT >= 4 && PICO_SCANVIDEO_PIXEL_GCOUNT <= 8, "");
+static_assert(PICO_SCANVIDEO_PIXEL_BCOUNT >= 4 && PICO_SCANVIDEO_PIXEL_BCOUNT <= 8, "");
+
+#define CHANNEL_MASK(count) ((1u << (count)) - 1u)
+
+// widen a channel to 8 bits by replicating its top bits into the bottom ones (so full scale stays full scale)
+#define EXPAND8(v, count) (((v) << (8 - (count))) | ((v) >> (2 * (count) - 8)))
+
+static inline uint32_t scanvideo_r8(uint16_t p) {
+    uint v = (p >> PICO_SCANVIDEO_PIXEL_RSHIFT) & CHANNEL_MASK(PICO_SCANVIDEO_PIXEL_RCOUNT);
+    return EXPAND8(v, PICO_SCANVIDEO_PIXEL_RCOUNT);
+}
+
+static inline uint32_t scanvideo_g8(uint16_t p) {
+    uint v = (p >> PICO_SCANVIDEO_PIXEL_GSHIFT) & CHANNEL_MASK(PICO_SCANVIDEO_PIXEL_GCOUNT);
+    return EXPAND8(v, PICO_SCANVIDEO_PIXEL_GCOUNT);
+}
+
+static inline uint32_t scanvideo_b8(uint16_t p) {
+    uint v = (p >> PICO_SCANVIDEO_PIXEL_BSHIFT) & CHANNEL_MASK(PICO_SCANVIDEO_PIXEL_BCOUNT);
+    return EXPAND8(v, PICO_SCANVIDEO_PIXEL_BCOUNT);
+}
+
+#if CONVERT_SSE2
+#define VEC_T __m128i
+#define VEC_LOAD(p) _mm_loadu_si128((const __m128i *)(p))
+#define VEC_DUP(v) _mm_set1_epi16((int16_t)(v))
+#define VEC_AND(a, b) _mm_and_si128(a, b)
+#define VEC_OR(a, b) _mm_or_si128(a, b)
+#define VEC_SHR(a, n) _mm_srli_epi16(a, n)
+#define VEC_SHL(a, n) _mm_slli_epi16(a, n)
+#elif CONVERT_NEON
+#define VEC_T uint16x8_t
+#define VEC_LOAD(p) vld1q_u16(p)
+#define VEC_DUP(v) vdupq_n_u16((uint16_t)(v))
+#define VEC_AND(a, b) vandq_u16(a, b)
+#define VEC_OR(a, b) vorrq_u16(a, b)
+// shift counts may legitimately be zero, which the immediate forms don't allow
+#define VEC_SHR(a, n) vshlq_u16(a, vdupq_n_s16(-(int16_t)(n)))
+#define VEC_SHL(a, n) vshlq_u16(a, vdupq_n_s16((int16_t)(n)))
+#endif
+
+#ifdef VEC_T
+// the vector form of EXPAND8 applied to a channel, for 8 pixels
+static inline VEC_T vec_channel8(VEC_T p, uint shift, uint count) {
+    VEC_T v = VEC_AND(VEC_SHR(p, shift), VEC_DUP(CHANNEL_MASK(count)));
+    return VEC_OR(VEC_SHL(v, 8 - count), VEC_SHR(v, 2 * count - 8));
+}
+
+#define VEC_R8(p) vec_channel8(p, PICO_SCANVIDEO_PIXEL_RSHIFT, PICO_SCANVIDEO_PIXEL_RCOUNT)
+#define VEC_G8(p) vec_channel8(p, PICO_SCANVIDEO_PIXEL_GSHIFT, PICO_SCANVIDEO_PIXEL_GCOUNT)
+#define VEC_B8(p) vec_channel8(p, PICO_SCANVIDEO_PIXEL_BSHIFT, PICO_SCANVIDEO_PIXEL_BCOUNT)
+
+// c0..c2 are 8 bit values in 16 bit lanes; writes 8 pixels of c0, c1, c2, 0xff bytes
+static inline void store_x8888(uint8_t *dst, VEC_T c0, VEC_T c1, VEC_T c2) {
+    VEC_T lo = VEC_OR(c0, VEC_SHL(c1, 8));
+    VEC_T hi = VEC_OR(c2, VEC_DUP(0xff00));
+#if CONVERT_SSE2
+    _mm_storeu_si128((__m128i *) dst, _mm_unpacklo_epi16(lo, hi));
+    _mm_storeu_si128((__m128i *) (dst + 16), _mm_unpackhi_epi16(lo, hi));
+#else
+    vst2q_u16((uint16_t *) dst, (uint16x8x2_t) {{lo, hi}});
+#endif
+}
+#endif
+
+static void convert_bgrx8888(const uint16_t *src, void *dst, uint count) {
+    uint8_t *out = (uint8_t *) dst;
+    uint i = 0;
+#ifdef VEC_T
+    for (; i + 8 <= count; i += 8) {
+        VEC_T p = VEC_LOAD(src + i);
+        store_x8888(out + i * 4, VEC_B8(p), VEC_G8(p), VEC_R8(p));
+    }
+#endif
+    for (; i < count; i++) {
+        uint16_t p = src[i];
+        out[i * 4] = (uint8_t) scanvideo_b8(p);
+        out[i * 4 + 1] = (uint8_t) scanvideo_g8(p);
+        out[i * 4 + 2] = (uint8_t) scanvideo_r8(p);
+        out[i * 4 + 3] = 0xff;
+    }
+}
+
+static void convert_rgbx8888(const uint16_t *src, void *dst, uint count) {
+    uint8_t *out = (uint8_t *) dst;
+    uint i = 0;
+#ifdef VEC_T
+    for (; i + 8 <= count; i += 8) {
+        VEC_T p = VEC_LOAD(src + i);
+        store_x8888(out + i * 4, VEC_R8(p), VEC_G8(p), VEC_B8(p));
+    }
+#endif
+    for (; i < count; i++) {
+        uint16_t p = src[i];
+        out[i * 4] = (uint8_t) scanvideo_r8(p);
+        out[i * 4 + 1] = (uint8_t) scanvideo_g8(p);
+        out[i * 4 + 2] = (uint8_t) scanvideo_b8(p);
+        out[i * 4 + 3] = 0xff;
+    }
+}
+
+static void convert_rgb565(const uint16_t *src, void *dst, uint count) {
+    uint16_t *out = (uint16_t *) dst;
+    uint i = 0;
+#ifdef VEC_T
+    for (; i + 8 <= count; i += 8) {
+        VEC_T p = VEC_LOAD(src + i);
+        VEC_T v = VEC_OR(VEC_OR(VEC_SHL(VEC_SHR(VEC_R8(p), 3), 11), VEC_SHL(VEC_SHR(VEC_G8(p), 2), 5)),
+                         VEC_SHR(VEC_B8(p), 3));
+#if CONVERT_SSE2
+        _mm_storeu_si128((__m128i *) (out + i), v);
+#else
+        vst1q_u16(out + i, v);
+#endif
+    }
+#endif
+    for (; i < count; i++) {
+        uint16_t p = src[i];
+        out[i] = (uint16_t) (((scanvideo_r8(p) >> 3u) << 11u) | ((scanvideo_g8(p) >> 2u) << 5u) | (scanvideo_b8(p) >> 3u));
+    }
+}
+
+host_pixel_convert_fn host_pixel_convert_get(enum host_pixel_format format) {
+    switch (format) {
+        case HOST_PIXEL_FORMAT_BGRX8888:
+            return convert_bgrx8888;
+        case HOST_PIXEL_FORMAT_RGBX8888:
+            return convert_rgbx8888;
+        case HOST_PIXEL_FORMAT_RGB565:
+            return convert_rgb565;
+        default:
+            return NULL;
+    }
+}
+
+uint host_pixel_format_bytes_per_pixel(enum host_pixel_format format) {
+    return format == HOST_PIXEL_FORMAT_RGB565 ? 2 : 4;
+}
@@ -0,0 +1,217 @@
+/*
+ * Copyright (c) 2020 Raspberry Pi (Trading) Ltd.
+ *
+ * SPDX-License-Identifier: BSD-3-Clause
+ */
+
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "pico.h"
+#include "pico/host_resampler.h"
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#define RESAMPLE_SSE2 1
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#define RESAMPLE_NEON 1
+#endif
+
+// filter length (in input frames) when upsampling; it is stretched by the ratio when downsampling so the cutoff
+// can follow the output rate
+#ifndef PICO_HOST_RESAMPLER_TAPS
+#define PICO_HOST_RESAMPLER_TAPS 32
+#endif
+#define RESAMPLER_MAX_TAPS 256
+// rate pairs needing more phases than this (i.e. with no small common ratio) pick the nearest of this many
+#define RESAMPLER_MAX_PHASES 512
+// input frames buffered (beyond the filter length) per refill
+#define RESAMPLER_CHUNK_FRAMES 256
+#define RESAMPLER_KAISER_BETA 8.0
+// fraction of the lower Nyquist frequency left unattenuated
+#define RESAMPLER_ROLLOFF 0.92
+
+struct host_resampler {
+    uint channels;
+    uint taps;
+    uint phases;
+    // the input position advances by input_rate / output_rate frames per output frame, tracked exactly as
+    // pos + frac / output_step with frac < output_step
+    uint32_t input_step;
+    uint32_t output_step;
+    uint32_t step_whole;
+    uint32_t step_frac;
+    uint pos;
+    uint32_t frac;
+    // filter history, one de-interleaved run of buffer_frames per channel
+    float *buffer;
+    uint buffer_frames;
+    uint buffered;
+    float *coeffs;
+};
+
+static uint32_t gcd(uint32_t a, uint32_t b) {
+    while (b) {
+        uint32_t t = a % b;
+        a = b;
+        b = t;
+    }
+    return a;
+}
+
+static double bessel_i0(double x) {
+    double sum = 1, term = 1;
+    for (int k = 1; k < 32; k++) {
+        term *= x / (2 * k);
+        sum += term * term;
+    }
+    return sum;
+}
+
+static void design_filter(struct host_resampler *r, double cutoff) {
+    double half = r->taps / 2.0;
+    double i0_beta = bessel_i0(RESAMPLER_KAISER_BETA);
+    for (uint p = 0; p < r->phases; p++) {
+        float *c = r->coeffs + p * r->taps;
+        double phase = (double) p / r->phases;
+        double sum = 0;
+        for (uint k = 0; k < r->taps; k++) {
+            // distance from the output instant to the input frame this tap is applied to
+            double t = phase + half - 1 - k;
+            double x = 2 * cutoff * t;
+            double sinc = x == 0 ? 1 : sin(M_PI * x) / (M_PI * x);
+            double w = t / half;
+            double window = w * w >= 1 ? 0 : bessel_i0(RESAMPLER_KAISER_BETA * sqrt(1 - w * w)) / i0_beta;
+            c[k] = (float) (sinc * window);
+            sum += c[k];
+        }
+        // unity gain at DC for every phase
+        for (uint k = 0; k < r->taps; k++) c[k] = (float) (c[k] / sum);
+    }
+}
+
+struct host_resampler *host_resampler_create(uint input_rate, uint output_rate, uint channel_count) {
+    if (!input_rate || !output_rate || !channel_count) return NULL;
+    struct host_resampler *r = (struct host_resampler *) calloc(1, sizeof(struct host_resampler));
+    if (!r) return NULL;
+    uint32_t g = gcd(input_rate, output_rate);
+    r->channels = channel_count;
+    r->input_step = input_rate / g;
+    r->output_step = output_rate / g;
+    r->step_whole = r->input_step / r->output_step;
+    r->step_frac = r->input_step % r->output_step;
+    r->phases = MIN(r->output_step, RESAMPLER_MAX_PHASES);
+    double ratio = MIN(1.0, (double) output_rate / input_rate);
+    uint taps = (uint) ceil(PICO_HOST_RESAMPLER_TAPS / ratio);
+    r->taps = MIN((taps + 3) & ~3u, RESAMPLER_MAX_TAPS);
+    r->coeffs = (float *) malloc(r->phases * r->taps * sizeof(float));
+    r->buffer_frames = r->taps + RESAMPLER_CHUNK_FRAMES;
+    r->buffer = (float *) calloc(r->buffer_frames * channel_count, sizeof(float));
+    if (!r->coeffs || !r->buffer) {
+        host_resampler_destroy(r);
+        return NULL;
+    }
+    design_filter(r, 0.5 * ratio * RESAMPLER_ROLLOFF);
+    // start with silence before the first input frame, so the first output is aligned with it
+    r->buffered = r->taps / 2 - 1;
+    return r;
+}
+
+void host_resampler_destroy(struct host_resampler *resampler) {
+    if (!resampler) return;
+    free(resampler->coeffs);
+    free(resampler->buffer);
+    free(resampler);
+}
+
+static inline float dot(const float *a, const float *b, uint n) {
+    uint i = 0;
+#if RESAMPLE_SSE2
+    __m128 acc = _mm_setzero_ps();
+    for (; i < n; i += 4) {
+        acc = _mm_add_ps(acc, _mm_mul_ps(_mm_loadu_ps(a + i), _mm_loadu_ps(b + i)));
+    }
+    acc = _mm_add_ps(acc, _mm_movehl_ps(acc, acc));
+    acc = _mm_add_ss(acc, _mm_shuffle_ps(acc, acc, 1));
+    return _mm_cvtss_f32(acc);
+#elif RESAMPLE_NEON
+    float32x4_t acc = vdupq_n_f32(0);
+    for (; i < n; i += 4) {
+        acc = vmlaq_f32(acc, vld1q_f32(a + i), vld1q_f32(b + i));
+    }
+    float32x2_t sum = vadd_f32(vget_low_f32(acc), vget_high_f32(acc));
+    return vget_lane_f32(vpadd_f32(sum, sum), 0);
+#else
+    float acc = 0;
+    for (; i < n; i++) acc += a[i] * b[i];
+    return acc;
+#endif
+}
+
+static inline int16_t saturate_s16(float v) {
+    v = fminf(fmaxf(v, -32768.f), 32767.f);
+    return (int16_t) lrintf(v);
+}
+
+static inline uint refill(struct host_resampler *r, const void *in, uint frames, bool s8) {
+    // drop history the filter no longer reaches
+    uint drop = MIN(r->pos, r->buffered);
+    for (uint c = 0; c < r->channels; c++) {
+        float *b = r->buffer + c * r->buffer_frames;
+        memmove(b, b + drop, (r->buffered - drop) * sizeof(float));
+    }
+    r->buffered -= drop;
+    r->pos -= drop;
+    uint n = MIN(frames, r->buffer_frames - r->buffered);
+    for (uint c = 0; c < r->channels; c++) {
+        float *b = r->buffer + c * r->buffer_frames + r->buffered;
+        if (s8) {
+            const int8_t *src = (const int8_t *) in + c;
+            for (uint i = 0; i < n; i++) b[i] = (float) (src[i * r->channels] * 256);
+        } else {
+            const int16_t *src = (const int16_t *) in + c;
+            for (uint i = 0; i < n; i++) b[i] = (float) src[i * r->channels];
+        }
+    }
+    r->buffered += n;
+    return n;
+}
+
+static inline uint process(struct host_resampler *r, const void *in, uint input_frames, uint *input_frames_used,
+                           int16_t *out, uint output_frames, bool s8) {
+    uint produced = 0;
+    uint used = 0;
+    uint in_frame_bytes = r->channels * (s8 ? 1 : 2);
+    while (true) {
+        while (produced < output_frames && r->pos + r->taps <= r->buffered) {
+            uint phase = (uint) (((uint64_t) r->frac * r->phases) / r->output_step);
+            const float *c = r->coeffs + phase * r->taps;
+            for (uint ch = 0; ch < r->channels; ch++) {
+                *out++ = saturate_s16(dot(c, r->buffer + ch * r->buffer_frames + r->pos, r->taps));
+            }
+            produced++;
+            r->pos += r->step_whole;
+            r->frac += r->step_frac;
+            if (r->frac >= r->output_step) {
+                r->frac -= r->output_step;
+                r->pos++;
+            }
+        }
+        if (produced == output_frames || used == input_frames) break;
+        used += refill(r, (const uint8_t *) in + used * in_frame_bytes, input_frames - used, s8);
+    }
+    *input_frames_used = used;
+    return produced;
+}
+
+uint host_resampler_process_s16(struct host_resampler *resampler, const int16_t *in, uint input_frames,
+                                uint *input_frames_used, int16_t *out, uint output_frames) {
+    return process(resampler, in, input_frames, input_frames_used, out, output_frames, false);
+}
+
+uint host_resampler_process_s8(struct host_resampler *resampler, const int8_t *in, uint input_frames,
+                               uint *input_frames_used, int16_t *out, uint output_frames) {
+    return process(resampler, in, input_frames, input_frames_used, out, output_frames, true);
+}
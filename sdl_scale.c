@@ -0,0 +1,338 @@
+/*
+ * Copyright (c) 2020 Raspberry Pi (Trading) Ltd.
+ *
+ * SPDX-License-Identifier: BSD-3-Clause
+ */
+
+#include <string.h>
+
+#include "pico.h"
+#include "pico/host_scaler.h"
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#define SCALER_SSE2 1
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#define SCALER_NEON 1
+#endif
+
+#ifdef PICO_SCANVIDEO_SCALING_NEAREST
+static enum host_scaler_filter scaler_filter = HOST_SCALER_NEAREST;
+#else
+static enum host_scaler_filter scaler_filter = HOST_SCALER_BILINEAR;
+#endif
+
+// scratch; only ever used from the render thread
+static uint16_t *row_buffer;
+static uint row_buffer_size;
+static uint16_t *scale2x_buffer;
+static uint scale2x_buffer_size;
+static uint32_t *x_map;
+static uint x_map_size;
+
+void host_scaler_set_filter(enum host_scaler_filter filter) {
+    scaler_filter = filter;
+}
+
+enum host_scaler_filter host_scaler_get_filter(void) {
+    return scaler_filter;
+}
+
+#define ROW(base, pitch, y) ((uint16_t *)(((uint8_t *)(base)) + (size_t)(pitch) * (y)))
+#define CONST_ROW(base, pitch, y) ((const uint16_t *)(((const uint8_t *)(base)) + (size_t)(pitch) * (y)))
+
+static void ensure_row_buffers(uint width) {
+    if (width > row_buffer_size) {
+        free(row_buffer);
+        row_buffer = malloc(width * sizeof(uint16_t));
+        row_buffer_size = width;
+    }
+}
+
+static void ensure_x_map(uint width) {
+    if (width > x_map_size) {
+        free(x_map);
+        x_map = malloc(width * sizeof(uint32_t));
+        x_map_size = width;
+    }
+}
+
+// source position of the center of destination pixel i in 16.16 fixed point (pixel centers at .5)
+static inline int32_t source_pos(uint i, uint src_size, uint dst_size) {
+    int64_t pos = ((int64_t) (2 * i + 1) * src_size * 65536) / (2 * dst_size) - 32768;
+    return pos < 0 ? 0 : (int32_t) pos;
+}
+
+// ----------------------------------------------------------------------------------------------------------------
+// nearest
+
+static void nearest_row(const uint16_t *src, uint src_width, uint16_t *dst, uint dst_width) {
+    uint x = 0;
+    if (dst_width == src_width) {
+        memcpy(dst, src, dst_width * sizeof(uint16_t));
+        return;
+    }
+    if (dst_width == src_width * 2) {
+#if SCALER_SSE2
+        for (; x + 8 <= src_width; x += 8) {
+            __m128i v = _mm_loadu_si128((const __m128i *) (src + x));
+            _mm_storeu_si128((__m128i *) (dst + 2 * x), _mm_unpacklo_epi16(v, v));
+            _mm_storeu_si128((__m128i *) (dst + 2 * x + 8), _mm_unpackhi_epi16(v, v));
+        }
+#elif SCALER_NEON
+        for (; x + 8 <= src_width; x += 8) {
+            uint16x8_t v = vld1q_u16(src + x);
+            vst2q_u16(dst + 2 * x, (uint16x8x2_t) {{v, v}});
+        }
+#endif
+        for (; x < src_width; x++) {
+            dst[2 * x] = dst[2 * x + 1] = src[x];
+        }
+        return;
+    }
+    for (; x < dst_width; x++) {
+        dst[x] = src[x_map[x]];
+    }
+}
+
+static void scale_nearest(const uint16_t *src, uint src_pitch, uint src_width, uint src_height,
+                          uint16_t *dst, uint dst_pitch, uint dst_width, uint dst_height) {
+    ensure_x_map(dst_width);
+    for (uint x = 0; x < dst_width; x++) {
+        x_map[x] = (2 * x + 1) * src_width / (2 * dst_width);
+    }
+    int last_sy = -1;
+    for (uint y = 0; y < dst_height; y++) {
+        int sy = (int) ((2 * y + 1) * src_height / (2 * dst_height));
+        uint16_t *out = ROW(dst, dst_pitch, y);
+        if (sy == last_sy) {
+            memcpy(out, ROW(dst, dst_pitch, y - 1), dst_width * sizeof(uint16_t));
+        } else {
+            nearest_row(CONST_ROW(src, src_pitch, sy), src_width, out, dst_width);
+            last_sy = sy;
+        }
+    }
+}
+
+// ----------------------------------------------------------------------------------------------------------------
+// bilinear; the 5:6:5 fields are blended independently with 5 bit weights
+
+static inline uint16_t blend565(uint16_t a, uint16_t b, uint w) {
+    // spread the fields out so there is headroom for the multiply
+    uint32_t sa = (a | ((uint32_t) a << 16u)) & 0x07e0f81fu;
+    uint32_t sb = (b | ((uint32_t) b << 16u)) & 0x07e0f81fu;
+    uint32_t s = ((sa * (32 - w) + sb * w) >> 5u) & 0x07e0f81fu;
+    return (uint16_t) (s | (s >> 16u));
+}
+
+#if SCALER_SSE2
+static inline __m128i blend565_x8(__m128i a, __m128i b, __m128i wb) {
+    const __m128i mask5 = _mm_set1_epi16(0x1f);
+    const __m128i mask6 = _mm_set1_epi16(0x3f);
+    __m128i wa = _mm_sub_epi16(_mm_set1_epi16(32), wb);
+    __m128i hi = _mm_srli_epi16(_mm_add_epi16(_mm_mullo_epi16(_mm_srli_epi16(a, 11), wa),
+                                              _mm_mullo_epi16(_mm_srli_epi16(b, 11), wb)), 5);
+    __m128i mid = _mm_srli_epi16(_mm_add_epi16(_mm_mullo_epi16(_mm_and_si128(_mm_srli_epi16(a, 5), mask6), wa),
+                                               _mm_mullo_epi16(_mm_and_si128(_mm_srli_epi16(b, 5), mask6), wb)), 5);
+    __m128i lo = _mm_srli_epi16(_mm_add_epi16(_mm_mullo_epi16(_mm_and_si128(a, mask5), wa),
+                                              _mm_mullo_epi16(_mm_and_si128(b, mask5), wb)), 5);
+    return _mm_or_si128(_mm_or_si128(_mm_slli_epi16(hi, 11), _mm_slli_epi16(mid, 5)), lo);
+}
+#elif SCALER_NEON
+static inline uint16x8_t blend565_x8(uint16x8_t a, uint16x8_t b, uint16x8_t wb) {
+    const uint16x8_t mask5 = vdupq_n_u16(0x1f);
+    const uint16x8_t mask6 = vdupq_n_u16(0x3f);
+    uint16x8_t wa = vsubq_u16(vdupq_n_u16(32), wb);
+    uint16x8_t hi = vshrq_n_u16(vmlaq_u16(vmulq_u16(vshrq_n_u16(a, 11), wa), vshrq_n_u16(b, 11), wb), 5);
+    uint16x8_t mid = vshrq_n_u16(vmlaq_u16(vmulq_u16(vandq_u16(vshrq_n_u16(a, 5), mask6), wa),
+                                           vandq_u16(vshrq_n_u16(b, 5), mask6), wb), 5);
+    uint16x8_t lo = vshrq_n_u16(vmlaq_u16(vmulq_u16(vandq_u16(a, mask5), wa), vandq_u16(b, mask5), wb), 5);
+    return vorrq_u16(vorrq_u16(vshlq_n_u16(hi, 11), vshlq_n_u16(mid, 5)), lo);
+}
+#endif
+
+static void blend_rows(const uint16_t *a, const uint16_t *b, uint16_t *out, uint width, uint w) {
+    uint x = 0;
+    if (!w) {
+        memcpy(out, a, width * sizeof(uint16_t));
+        return;
+    }
+#if SCALER_SSE2
+    __m128i wv = _mm_set1_epi16((int16_t) w);
+    for (; x + 8 <= width; x += 8) {
+        __m128i va = _mm_loadu_si128((const __m128i *) (a + x));
+        __m128i vb = _mm_loadu_si128((const __m128i *) (b + x));
+        _mm_storeu_si128((__m128i *) (out + x), blend565_x8(va, vb, wv));
+    }
+#elif SCALER_NEON
+    uint16x8_t wv = vdupq_n_u16((uint16_t) w);
+    for (; x + 8 <= width; x += 8) {
+        vst1q_u16(out + x, blend565_x8(vld1q_u16(a + x), vld1q_u16(b + x), wv));
+    }
+#endif
+    for (; x < width; x++) {
+        out[x] = blend565(a[x], b[x], w);
+    }
+}
+
+// x_map holds source index << 5 | weight
+static void blend_columns(const uint16_t *src, uint src_width, uint16_t *out, uint dst_width) {
+    uint x = 0;
+#if SCALER_SSE2 || SCALER_NEON
+    uint16_t pa[8], pb[8], pw[8];
+    for (; x + 8 <= dst_width; x += 8) {
+        for (int i = 0; i < 8; i++) {
+            uint32_t m = x_map[x + i];
+            uint sx = m >> 5u;
+            pa[i] = src[sx];
+            pb[i] = src[sx + 1 < src_width ? sx + 1 : sx];
+            pw[i] = m & 31u;
+        }
+#if SCALER_SSE2
+        __m128i v = blend565_x8(_mm_loadu_si128((const __m128i *) pa), _mm_loadu_si128((const __m128i *) pb),
+                                _mm_loadu_si128((const __m128i *) pw));
+        _mm_storeu_si128((__m128i *) (out + x), v);
+#else
+        vst1q_u16(out + x, blend565_x8(vld1q_u16(pa), vld1q_u16(pb), vld1q_u16(pw)));
+#endif
+    }
+#endif
+    for (; x < dst_width; x++) {
+        uint32_t m = x_map[x];
+        uint sx = m >> 5u;
+        out[x] = blend565(src[sx], src[sx + 1 < src_width ? sx + 1 : sx], m & 31u);
+    }
+}
+
+static void scale_bilinear(const uint16_t *src, uint src_pitch, uint src_width, uint src_height,
+                           uint16_t *dst, uint dst_pitch, uint dst_width, uint dst_height) {
+    ensure_row_buffers(src_width);
+    ensure_x_map(dst_width);
+    for (uint x = 0; x < dst_width; x++) {
+        int32_t pos = source_pos(x, src_width, dst_width);
+        uint sx = (uint) pos >> 16u;
+        if (sx >= src_width) sx = src_width - 1;
+        x_map[x] = (sx << 5u) | (((uint) pos >> 11u) & 31u);
+    }
+    int32_t last_pos = -1;
+    for (uint y = 0; y < dst_height; y++) {
+        int32_t pos = source_pos(y, src_height, dst_height) & ~0x7ff; // only 5 bits of weight are used
+        uint16_t *out = ROW(dst, dst_pitch, y);
+        if (pos == last_pos) {
+            memcpy(out, ROW(dst, dst_pitch, y - 1), dst_width * sizeof(uint16_t));
+            continue;
+        }
+        uint sy = (uint) pos >> 16u;
+        if (sy >= src_height) sy = src_height - 1;
+        uint sy1 = sy + 1 < src_height ? sy + 1 : sy;
+        blend_rows(CONST_ROW(src, src_pitch, sy), CONST_ROW(src, src_pitch, sy1), row_buffer, src_width,
+                   ((uint) pos >> 11u) & 31u);
+        blend_columns(row_buffer, src_width, out, dst_width);
+        last_pos = pos;
+    }
+}
+
+// ----------------------------------------------------------------------------------------------------------------
+// scale2x (EPX)
+
+static inline void scale2x_pixel(uint16_t b, uint16_t d, uint16_t e, uint16_t f, uint16_t h,
+                                 uint16_t *out0, uint16_t *out1) {
+    if (b != h && d != f) {
+        out0[0] = d == b ? d : e;
+        out0[1] = b == f ? f : e;
+        out1[0] = d == h ? d : e;
+        out1[1] = h == f ? f : e;
+    } else {
+        out0[0] = out0[1] = out1[0] = out1[1] = e;
+    }
+}
+
+static void scale2x_row(const uint16_t *above, const uint16_t *row, const uint16_t *below, uint width,
+                        uint16_t *out0, uint16_t *out1) {
+    scale2x_pixel(above[0], row[0], row[0], width > 1 ? row[1] : row[0], below[0], out0, out1);
+    uint x = 1;
+#if SCALER_SSE2
+    const __m128i ones = _mm_set1_epi16(-1);
+    for (; x + 9 <= width; x += 8) {
+        __m128i b = _mm_loadu_si128((const __m128i *) (above + x));
+        __m128i h = _mm_loadu_si128((const __m128i *) (below + x));
+        __m128i d = _mm_loadu_si128((const __m128i *) (row + x - 1));
+        __m128i e = _mm_loadu_si128((const __m128i *) (row + x));
+        __m128i f = _mm_loadu_si128((const __m128i *) (row + x + 1));
+        __m128i active = _mm_andnot_si128(_mm_or_si128(_mm_cmpeq_epi16(b, h), _mm_cmpeq_epi16(d, f)), ones);
+        __m128i m0 = _mm_and_si128(active, _mm_cmpeq_epi16(d, b));
+        __m128i m1 = _mm_and_si128(active, _mm_cmpeq_epi16(b, f));
+        __m128i m2 = _mm_and_si128(active, _mm_cmpeq_epi16(d, h));
+        __m128i m3 = _mm_and_si128(active, _mm_cmpeq_epi16(h, f));
+        __m128i e0 = _mm_or_si128(_mm_and_si128(m0, d), _mm_andnot_si128(m0, e));
+        __m128i e1 = _mm_or_si128(_mm_and_si128(m1, f), _mm_andnot_si128(m1, e));
+        __m128i e2 = _mm_or_si128(_mm_and_si128(m2, d), _mm_andnot_si128(m2, e));
+        __m128i e3 = _mm_or_si128(_mm_and_si128(m3, f), _mm_andnot_si128(m3, e));
+        _mm_storeu_si128((__m128i *) (out0 + 2 * x), _mm_unpacklo_epi16(e0, e1));
+        _mm_storeu_si128((__m128i *) (out0 + 2 * x + 8), _mm_unpackhi_epi16(e0, e1));
+        _mm_storeu_si128((__m128i *) (out1 + 2 * x), _mm_unpacklo_epi16(e2, e3));
+        _mm_storeu_si128((__m128i *) (out1 + 2 * x + 8), _mm_unpackhi_epi16(e2, e3));
+    }
+#elif SCALER_NEON
+    for (; x + 9 <= width; x += 8) {
+        uint16x8_t b = vld1q_u16(above + x);
+        uint16x8_t h = vld1q_u16(below + x);
+        uint16x8_t d = vld1q_u16(row + x - 1);
+        uint16x8_t e = vld1q_u16(row + x);
+        uint16x8_t f = vld1q_u16(row + x + 1);
+        uint16x8_t active = vmvnq_u16(vorrq_u16(vceqq_u16(b, h), vceqq_u16(d, f)));
+        uint16x8x2_t top, bottom;
+        top.val[0] = vbslq_u16(vandq_u16(active, vceqq_u16(d, b)), d, e);
+        top.val[1] = vbslq_u16(vandq_u16(active, vceqq_u16(b, f)), f, e);
+        bottom.val[0] = vbslq_u16(vandq_u16(active, vceqq_u16(d, h)), d, e);
+        bottom.val[1] = vbslq_u16(vandq_u16(active, vceqq_u16(h, f)), f, e);
+        vst2q_u16(out0 + 2 * x, top);
+        vst2q_u16(out1 + 2 * x, bottom);
+    }
+#endif
+    for (; x < width; x++) {
+        scale2x_pixel(above[x], row[x - 1], row[x], x + 1 < width ? row[x + 1] : row[x], below[x],
+                      out0 + 2 * x, out1 + 2 * x);
+    }
+}
+
+static void scale2x(const uint16_t *src, uint src_pitch, uint src_width, uint src_height,
+                    uint16_t *dst, uint dst_pitch) {
+    for (uint y = 0; y < src_height; y++) {
+        const uint16_t *row = CONST_ROW(src, src_pitch, y);
+        const uint16_t *above = y ? CONST_ROW(src, src_pitch, y - 1) : row;
+        const uint16_t *below = y + 1 < src_height ? CONST_ROW(src, src_pitch, y + 1) : row;
+        scale2x_row(above, row, below, src_width, ROW(dst, dst_pitch, 2 * y), ROW(dst, dst_pitch, 2 * y + 1));
+    }
+}
+
+void host_scaler_scale(const uint16_t *src, uint src_pitch, uint src_width, uint src_height,
+                       uint16_t *dst, uint dst_pitch, uint dst_width, uint dst_height) {
+    if (!src_width || !src_height || !dst_width || !dst_height) return;
+    switch (scaler_filter) {
+        case HOST_SCALER_SCALE2X:
+            if (dst_width == src_width * 2 && dst_height == src_height * 2) {
+                scale2x(src, src_pitch, src_width, src_height, dst, dst_pitch);
+            } else {
+                // scale2x and then make up the difference with nearest
+                uint size = src_width * src_height * 4;
+                if (size > scale2x_buffer_size) {
+                    free(scale2x_buffer);
+                    scale2x_buffer = malloc(size * sizeof(uint16_t));
+                    scale2x_buffer_size = size;
+                }
+                uint pitch = src_width * 2 * sizeof(uint16_t);
+                scale2x(src, src_pitch, src_width, src_height, scale2x_buffer, pitch);
+                scale_nearest(scale2x_buffer, pitch, src_width * 2, src_height * 2, dst, dst_pitch, dst_width,
+                              dst_height);
+            }
+            break;
+        case HOST_SCALER_BILINEAR:
+            scale_bilinear(src, src_pitch, src_width, src_height, dst, dst_pitch, dst_width, dst_height);
+            break;
+        default:
+            scale_nearest(src, src_pitch, src_width, src_height, dst, dst_pitch, dst_width, dst_height);
+            break;
+    }
+}
@@ -0,0 +1,198 @@
+/*
+ * Copyright (c) 2020 Raspberry Pi (Trading) Ltd.
+ *
+ * SPDX-License-Identifier: BSD-3-Clause
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "pico.h"
+#include "pico/host_scanline_record.h"
+#include "sdl_le.h"
+
+#define SCANLINE_RECORD_WRITE_BUFFER_BYTES 65536
+
+struct host_scanline_writer {
+    FILE *file;
+};
+
+struct host_scanline_reader {
+    FILE *file;
+    // the current record's words, for every segment and plane
+    uint32_t *words;
+};
+
+static bool write_words(FILE *file, const uint32_t *words, uint count) {
+    uint8_t buf[256];
+    while (count) {
+        uint n = MIN(count, sizeof(buf) / 4);
+        uint8_t *p = buf;
+        for (uint i = 0; i < n; i++) put_le(&p, words[i], 4);
+        if (fwrite(buf, 4, n, file) != n) return false;
+        words += n;
+        count -= n;
+    }
+    return true;
+}
+
+static bool read_words(FILE *file, uint32_t *words, uint count) {
+    uint8_t buf[256];
+    while (count) {
+        uint n = MIN(count, sizeof(buf) / 4);
+        if (fread(buf, 4, n, file) != n) return false;
+        const uint8_t *p = buf;
+        for (uint i = 0; i < n; i++) words[i] = get_le(&p, 4);
+        words += n;
+        count -= n;
+    }
+    return true;
+}
+
+struct host_scanline_writer *host_scanline_writer_open(const char *path) {
+    FILE *file = fopen(path, "wb");
+    if (!file) return NULL;
+    struct host_scanline_writer *writer = (struct host_scanline_writer *) calloc(1, sizeof(struct host_scanline_writer));
+    if (!writer) {
+        fclose(file);
+        return NULL;
+    }
+    setvbuf(file, NULL, _IOFBF, SCANLINE_RECORD_WRITE_BUFFER_BYTES);
+    writer->file = file;
+    uint8_t header[8];
+    uint8_t *p = header;
+    put_le(&p, PICO_HOST_SCANLINE_RECORD_MAGIC, 4);
+    put_le(&p, PICO_HOST_SCANLINE_RECORD_VERSION, 2);
+    put_le(&p, 0, 2);
+    fwrite(header, 1, sizeof(header), file);
+    return writer;
+}
+
+bool host_scanline_writer_write_mode(struct host_scanline_writer *writer, const struct host_scanline_record_mode *mode) {
+    uint8_t buf[23];
+    uint8_t *p = buf;
+    put_le(&p, PICO_HOST_SCANLINE_RECORD_MODE, 1);
+    put_le(&p, mode->width, 2);
+    put_le(&p, mode->height, 2);
+    put_le(&p, mode->xscale, 2);
+    put_le(&p, mode->yscale, 2);
+    put_le(&p, mode->yscale_denominator, 2);
+    put_le(&p, mode->clock_freq, 4);
+    put_le(&p, mode->h_active, 2);
+    put_le(&p, mode->v_active, 2);
+    put_le(&p, mode->h_total, 2);
+    put_le(&p, mode->v_total, 2);
+    return fwrite(buf, 1, sizeof(buf), writer->file) == sizeof(buf);
+}
+
+bool host_scanline_writer_write_scanline(struct host_scanline_writer *writer, const struct host_scanline_record *record) {
+    uint8_t buf[14];
+    uint8_t *p = buf;
+    put_le(&p, PICO_HOST_SCANLINE_RECORD_SCANLINE, 1);
+    put_le(&p, record->scanline_id, 4);
+    put_le(&p, record->delta_us, 4);
+    put_le(&p, record->repeat_count, 2);
+    put_le(&p, record->plane_count, 1);
+    put_le(&p, record->segment_count, 1);
+    put_le(&p, record->flags, 1);
+    bool ok = fwrite(buf, 1, sizeof(buf), writer->file) == sizeof(buf);
+    for (uint s = 0; ok && s < record->segment_count; s++) {
+        const struct host_scanline_record_segment *segment = record->segments + s;
+        p = buf;
+        put_le(&p, segment->rows, 2);
+        ok = fwrite(buf, 1, 2, writer->file) == 2;
+        for (uint plane = 0; ok && plane < record->plane_count; plane++) {
+            p = buf;
+            put_le(&p, segment->word_count[plane], 2);
+            ok = fwrite(buf, 1, 2, writer->file) == 2 &&
+                 write_words(writer->file, segment->words[plane], segment->word_count[plane]);
+        }
+    }
+    return ok;
+}
+
+void host_scanline_writer_close(struct host_scanline_writer *writer) {
+    if (!writer) return;
+    fclose(writer->file);
+    free(writer);
+}
+
+struct host_scanline_reader *host_scanline_reader_open(const char *path) {
+    FILE *file = fopen(path, "rb");
+    if (!file) return NULL;
+    uint8_t header[8];
+    const uint8_t *p = header;
+    if (fread(header, 1, sizeof(header), file) != sizeof(header) ||
+        get_le(&p, 4) != PICO_HOST_SCANLINE_RECORD_MAGIC || get_le(&p, 2) != PICO_HOST_SCANLINE_RECORD_VERSION) {
+        fclose(file);
+        return NULL;
+    }
+    struct host_scanline_reader *reader = (struct host_scanline_reader *) calloc(1, sizeof(struct host_scanline_reader));
+    uint32_t *words = (uint32_t *) malloc(PICO_HOST_SCANLINE_RECORD_MAX_SEGMENTS * PICO_HOST_SCANLINE_RECORD_MAX_PLANES *
+                                          PICO_HOST_SCANLINE_RECORD_MAX_WORDS * sizeof(uint32_t));
+    if (!reader || !words) {
+        free(reader);
+        free(words);
+        fclose(file);
+        return NULL;
+    }
+    reader->file = file;
+    reader->words = words;
+    return reader;
+}
+
+uint host_scanline_reader_next(struct host_scanline_reader *reader, struct host_scanline_record_mode *mode,
+                               struct host_scanline_record *record) {
+    uint8_t buf[22];
+    const uint8_t *p = buf;
+    int type = fgetc(reader->file);
+    if (type == PICO_HOST_SCANLINE_RECORD_MODE) {
+        if (fread(buf, 1, 22, reader->file) != 22) return 0;
+        mode->width = get_le(&p, 2);
+        mode->height = get_le(&p, 2);
+        mode->xscale = get_le(&p, 2);
+        mode->yscale = get_le(&p, 2);
+        mode->yscale_denominator = get_le(&p, 2);
+        mode->clock_freq = get_le(&p, 4);
+        mode->h_active = get_le(&p, 2);
+        mode->v_active = get_le(&p, 2);
+        mode->h_total = get_le(&p, 2);
+        mode->v_total = get_le(&p, 2);
+        return PICO_HOST_SCANLINE_RECORD_MODE;
+    }
+    if (type != PICO_HOST_SCANLINE_RECORD_SCANLINE || fread(buf, 1, 13, reader->file) != 13) return 0;
+    record->scanline_id = get_le(&p, 4);
+    record->delta_us = get_le(&p, 4);
+    record->repeat_count = get_le(&p, 2);
+    record->plane_count = get_le(&p, 1);
+    record->segment_count = get_le(&p, 1);
+    record->flags = get_le(&p, 1);
+    if (record->plane_count > PICO_HOST_SCANLINE_RECORD_MAX_PLANES ||
+        record->segment_count > PICO_HOST_SCANLINE_RECORD_MAX_SEGMENTS) {
+        return 0;
+    }
+    uint32_t *words = reader->words;
+    for (uint s = 0; s < record->segment_count; s++) {
+        struct host_scanline_record_segment *segment = record->segments + s;
+        p = buf;
+        if (fread(buf, 1, 2, reader->file) != 2) return 0;
+        segment->rows = get_le(&p, 2);
+        for (uint plane = 0; plane < record->plane_count; plane++) {
+            p = buf;
+            if (fread(buf, 1, 2, reader->file) != 2) return 0;
+            uint count = get_le(&p, 2);
+            if (count > PICO_HOST_SCANLINE_RECORD_MAX_WORDS || !read_words(reader->file, words, count)) return 0;
+            segment->word_count[plane] = count;
+            segment->words[plane] = words;
+            words += PICO_HOST_SCANLINE_RECORD_MAX_WORDS;
+        }
+    }
+    return PICO_HOST_SCANLINE_RECORD_SCANLINE;
+}
+
+void host_scanline_reader_close(struct host_scanline_reader *reader) {
+    if (!reader) return;
+    fclose(reader->file);
+    free(reader->words);
+    free(reader);
+}
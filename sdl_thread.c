@@ -0,0 +1,193 @@
+/*
+ * Copyright (c) 2020 Raspberry Pi (Trading) Ltd.
+ *
+ * SPDX-License-Identifier: BSD-3-Clause
+ */
+
+#ifdef __linux__
+#define _GNU_SOURCE // pthread_setaffinity_np
+#endif
+#include <assert.h>
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#ifndef _WIN32
+#include <pthread.h>
+#include <sched.h>
+#endif
+#include "SDL.h"
+
+#include "pico.h"
+#include "pico/host_core_time.h"
+#include "pico/host_thread.h"
+#include "pico/host_trace.h"
+
+#ifdef _MSC_VER
+#define strtok_r strtok_s
+#endif
+
+#ifdef _WIN32
+// neither affinity nor scheduling can be applied, so there is no need to keep hold of the threads
+typedef int host_thread_handle;
+static host_thread_handle thread_self(void) {
+    return 0;
+}
+#else
+typedef pthread_t host_thread_handle;
+static host_thread_handle thread_self(void) {
+    return pthread_self();
+}
+#endif
+
+static_assert(HOST_THREAD_CORE0 == 0 && HOST_THREAD_CORE1 == 1 && NUM_CORES == 2, "");
+
+_Thread_local uint8_t host_thread_current = HOST_THREAD_OTHER;
+
+static const char *const thread_names[HOST_THREAD_COUNT] = {
+        "Core 0", "Core 1", "SDL main", "SDL timer", "Audio", NULL,
+};
+
+// as used in PICO_HOST_SDL_AFFINITY and PICO_HOST_SDL_SCHED; other threads never identify themselves
+static const char *const thread_keys[HOST_THREAD_OTHER] = {
+        "core0", "core1", "main", "timer", "audio",
+};
+
+// guards everything below
+static SDL_SpinLock thread_config_lock;
+static bool thread_config_loaded;
+static struct host_thread_config thread_configs[HOST_THREAD_COUNT];
+// the last thread to identify as each id
+static host_thread_handle threads[HOST_THREAD_COUNT];
+static bool thread_known[HOST_THREAD_COUNT];
+
+const char *host_thread_name(enum host_thread_id id) {
+    return id < HOST_THREAD_COUNT ? thread_names[id] : NULL;
+}
+
+static void thread_apply_config(enum host_thread_id id, host_thread_handle thread, const struct host_thread_config *config) {
+    const char *name = id < HOST_THREAD_OTHER ? thread_keys[id] : "other";
+    if (config->cpus) {
+#ifdef __linux__
+        cpu_set_t set;
+        CPU_ZERO(&set);
+        for (int cpu = 0; cpu < 64; cpu++) {
+            if ((config->cpus >> cpu) & 1) CPU_SET(cpu, &set);
+        }
+        int err = pthread_setaffinity_np(thread, sizeof(set), &set);
+        if (err) printf("Can't set the CPU affinity of %s: %s\n", name, strerror(err));
+#else
+        printf("Can't set the CPU affinity of %s: not supported on this platform\n", name);
+#endif
+    }
+    if (config->sched != HOST_THREAD_SCHED_DEFAULT) {
+#ifdef _WIN32
+        printf("Can't set the scheduling of %s: not supported on this platform\n", name);
+#else
+        int policy = config->sched == HOST_THREAD_SCHED_FIFO ? SCHED_FIFO : SCHED_RR;
+        struct sched_param param = {
+                .sched_priority = MAX(sched_get_priority_min(policy), MIN(sched_get_priority_max(policy), config->priority))
+        };
+        int err = pthread_setschedparam(thread, policy, &param);
+        if (err) {
+            printf("Can't use %s scheduling for %s: %s%s\n", config->sched == HOST_THREAD_SCHED_FIFO ? "FIFO" : "RR",
+                   name, strerror(err), err == EPERM ? " (real time scheduling isn't permitted)" : "");
+        }
+#endif
+    }
+}
+
+// "0,2-3" into a mask of CPUs
+static bool parse_cpus(const char *s, uint64_t *cpus) {
+    *cpus = 0;
+    while (*s) {
+        char *end;
+        unsigned long first = strtoul(s, &end, 10), last = first;
+        if (end == s) return false;
+        if (*end == '-') {
+            s = end + 1;
+            last = strtoul(s, &end, 10);
+            if (end == s || last < first) return false;
+        }
+        if (last > 63) return false;
+        for (unsigned long cpu = first; cpu <= last; cpu++) *cpus |= 1ull << cpu;
+        s = end;
+        if (*s == ',') s++;
+        else if (*s) return false;
+    }
+    return *cpus != 0;
+}
+
+// "fifo", "rr" or either with ":<priority>"
+static bool parse_sched(const char *s, struct host_thread_config *config) {
+    size_t len = strcspn(s, ":");
+    if (len == 4 && !strncmp(s, "fifo", 4)) config->sched = HOST_THREAD_SCHED_FIFO;
+    else if (len == 2 && !strncmp(s, "rr", 2)) config->sched = HOST_THREAD_SCHED_RR;
+    else return false;
+    config->priority = s[len] ? atoi(s + len + 1) : 0;
+    return true;
+}
+
+static void thread_config_from_env(const char *name, bool sched) {
+    const char *env = getenv(name);
+    if (!env) return;
+    char *entries = strdup(env);
+    if (!entries) return;
+    char *save;
+    for (char *entry = strtok_r(entries, " \t", &save); entry; entry = strtok_r(NULL, " \t", &save)) {
+        char *value = strchr(entry, '=');
+        int id = HOST_THREAD_OTHER;
+        if (value) {
+            *value++ = 0;
+            for (id = 0; id < HOST_THREAD_OTHER && strcmp(entry, thread_keys[id]); id++);
+        }
+        struct host_thread_config *config = thread_configs + id;
+        if (id == HOST_THREAD_OTHER || !(sched ? parse_sched(value, config) : parse_cpus(value, &config->cpus))) {
+            printf("Unknown %s entry '%s%s%s'\n", name, entry, value ? "=" : "", value ? value : "");
+        }
+    }
+    free(entries);
+}
+
+// called with thread_config_lock held
+static void thread_config_load(void) {
+    if (thread_config_loaded) return;
+    thread_config_loaded = true;
+    thread_config_from_env("PICO_HOST_SDL_AFFINITY", false);
+    thread_config_from_env("PICO_HOST_SDL_SCHED", true);
+}
+
+void host_thread_set_id(enum host_thread_id id) {
+    assert(id < HOST_THREAD_COUNT);
+    // callback threads identify themselves on every callback
+    if (id == host_thread_current) return;
+    host_thread_current = (uint8_t) id;
+    host_trace_set_thread_name(thread_names[id]);
+    if (id < NUM_CORES) host_core_time_thread_start(id);
+    SDL_AtomicLock(&thread_config_lock);
+    thread_config_load();
+    threads[id] = thread_self();
+    thread_known[id] = true;
+    struct host_thread_config config = thread_configs[id];
+    SDL_AtomicUnlock(&thread_config_lock);
+    thread_apply_config(id, thread_self(), &config);
+}
+
+void host_thread_set_config(enum host_thread_id id, const struct host_thread_config *config) {
+    assert(id < HOST_THREAD_COUNT);
+    SDL_AtomicLock(&thread_config_lock);
+    thread_config_load();
+    thread_configs[id] = *config;
+    bool known = thread_known[id];
+    host_thread_handle thread = threads[id];
+    SDL_AtomicUnlock(&thread_config_lock);
+    if (known) thread_apply_config(id, thread, config);
+}
+
+void host_thread_get_config(enum host_thread_id id, struct host_thread_config *config) {
+    assert(id < HOST_THREAD_COUNT);
+    SDL_AtomicLock(&thread_config_lock);
+    thread_config_load();
+    *config = thread_configs[id];
+    SDL_AtomicUnlock(&thread_config_lock);
+}
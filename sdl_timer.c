@@ -5,6 +5,8 @@
  */
 
 #include "pico/time.h"
+#include "pico/host_thread.h"
+#include "pico/host_trace.h"
 #include "SDL_timer.h"
 
 SDL_TimerID hardware_alarm_timers[NUM_GENERIC_TIMERS];
@@ -29,7 +31,10 @@ static Uint32 alarm_callback(Uint32 interval, void *param) {
     uint32_t alarm_num = (uint)(intptr_t)param;
     assert(alarm_num < NUM_GENERIC_TIMERS);
     assert(hardware_alarm_callbacks[alarm_num]);
+    host_thread_set_id(HOST_THREAD_TIMER);
+    host_trace_begin(HOST_TRACE_ALARM, alarm_num);
     hardware_alarm_callbacks[alarm_num](alarm_num);
+    host_trace_end(HOST_TRACE_ALARM, alarm_num);
     return 0;
 }
 
@@ -60,7 +65,10 @@ uint current_hardware_alarm_num;
 
 uint32_t pool_timer_callback(uint32_t period, void *param) {
     current_hardware_alarm_num = (uint32_t)(uintptr_t)param;
+    host_thread_set_id(HOST_THREAD_TIMER);
+    host_trace_begin(HOST_TRACE_ALARM, current_hardware_alarm_num);
     alarm_pool_irq_handler();
+    host_trace_end(HOST_TRACE_ALARM, current_hardware_alarm_num);
     return 0;
 }
 
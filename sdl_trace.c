@@ -0,0 +1,165 @@
+/*
+ * Copyright (c) 2020 Raspberry Pi (Trading) Ltd.
+ *
+ * SPDX-License-Identifier: BSD-3-Clause
+ */
+
+#include <assert.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "SDL.h"
+
+#include "pico.h"
+#include "pico/host_trace.h"
+
+static_assert(!(PICO_HOST_TRACE_RING_EVENTS & (PICO_HOST_TRACE_RING_EVENTS - 1)), "");
+
+struct trace_event {
+    uint64_t ticks;
+    uint32_t arg;
+    uint8_t event;
+    char phase;
+};
+
+// written only by its own thread; once full, each event replaces the oldest
+struct trace_ring {
+    struct trace_ring *next;
+    SDL_threadID thread_id;
+    const char *_Atomic name;
+    // events ever recorded, and the first of those which belongs to the current trace
+    atomic_uint_fast64_t head;
+    atomic_uint_fast64_t first;
+    struct trace_event events[PICO_HOST_TRACE_RING_EVENTS];
+};
+
+static const char *const event_names[HOST_TRACE_EVENT_COUNT] = {
+        "scanline", "vblank", "wfe", "spin_lock", "alarm", "audio_give", "audio_write", "sd_sector",
+};
+
+volatile bool host_trace_enabled;
+
+static _Thread_local struct trace_ring *thread_ring;
+static _Thread_local const char *thread_name;
+
+// rings are only ever added, so the list may be walked without the lock
+static struct trace_ring *_Atomic rings;
+static SDL_SpinLock rings_lock;
+static char *trace_path;
+static uint64_t trace_start_ticks;
+
+static struct trace_ring *trace_ring_create(void) {
+    struct trace_ring *ring = (struct trace_ring *) calloc(1, sizeof(struct trace_ring));
+    if (!ring) return NULL;
+    ring->thread_id = SDL_ThreadID();
+    atomic_store(&ring->name, thread_name);
+    SDL_AtomicLock(&rings_lock);
+    ring->next = atomic_load(&rings);
+    atomic_store(&rings, ring);
+    SDL_AtomicUnlock(&rings_lock);
+    return ring;
+}
+
+void host_trace_record(enum host_trace_event event, char phase, uint32_t arg) {
+    struct trace_ring *ring = thread_ring;
+    if (!ring) {
+        ring = thread_ring = trace_ring_create();
+        if (!ring) return;
+    }
+    uint64_t head = atomic_load_explicit(&ring->head, memory_order_relaxed);
+    struct trace_event *e = ring->events + (head & (PICO_HOST_TRACE_RING_EVENTS - 1));
+    e->ticks = SDL_GetPerformanceCounter();
+    e->arg = arg;
+    e->event = (uint8_t) event;
+    e->phase = phase;
+    atomic_store_explicit(&ring->head, head + 1, memory_order_release);
+}
+
+void host_trace_set_thread_name(const char *name) {
+    thread_name = name;
+    if (thread_ring) atomic_store_explicit(&thread_ring->name, name, memory_order_relaxed);
+}
+
+static void trace_exit(void) {
+    if (host_trace_enabled) host_trace_dump();
+}
+
+bool host_trace_start(const char *path) {
+    char *path_copy = strdup(path);
+    if (!path_copy) return false;
+    static bool registered;
+    if (!registered) {
+        registered = true;
+        atexit(trace_exit);
+    }
+    host_trace_enabled = false;
+    free(trace_path);
+    trace_path = path_copy;
+    for (struct trace_ring *ring = atomic_load(&rings); ring; ring = ring->next) {
+        atomic_store(&ring->first, atomic_load(&ring->head));
+    }
+    trace_start_ticks = SDL_GetPerformanceCounter();
+    host_trace_enabled = true;
+    return true;
+}
+
+void host_trace_stop(void) {
+    host_trace_enabled = false;
+}
+
+// copies out the ring's events from the current trace, returning how many were copied; *skip is set to how many of
+// them (from the start) the thread overwrote while they were being copied
+static uint trace_ring_snapshot(struct trace_ring *ring, struct trace_event *out, uint *skip) {
+    uint64_t head = atomic_load_explicit(&ring->head, memory_order_acquire);
+    uint64_t first = atomic_load(&ring->first);
+    if (head - first > PICO_HOST_TRACE_RING_EVENTS) first = head - PICO_HOST_TRACE_RING_EVENTS;
+    for (uint64_t i = first; i < head; i++) {
+        out[i - first] = ring->events[i & (PICO_HOST_TRACE_RING_EVENTS - 1)];
+    }
+    // the slot for index i is reused as soon as index i + PICO_HOST_TRACE_RING_EVENTS is being recorded
+    uint64_t new_head = atomic_load_explicit(&ring->head, memory_order_acquire);
+    uint64_t reused = new_head >= PICO_HOST_TRACE_RING_EVENTS ? new_head - PICO_HOST_TRACE_RING_EVENTS + 1 : 0;
+    *skip = reused > first ? (uint) MIN(reused - first, head - first) : 0;
+    return (uint) (head - first);
+}
+
+bool host_trace_dump(void) {
+    if (!trace_path) return false;
+    FILE *file = fopen(trace_path, "w");
+    struct trace_event *events = (struct trace_event *) malloc(PICO_HOST_TRACE_RING_EVENTS * sizeof(struct trace_event));
+    if (!file || !events) {
+        printf("Error: can't write trace to %s\n", trace_path);
+        if (file) fclose(file);
+        free(events);
+        return false;
+    }
+    double us_per_tick = 1e6 / (double) SDL_GetPerformanceFrequency();
+    fprintf(file, "{\"displayTimeUnit\": \"ns\", \"traceEvents\": [\n");
+    fprintf(file, "{\"name\": \"process_name\", \"ph\": \"M\", \"pid\": 1, \"args\": {\"name\": \"pico_host_sdl\"}}");
+    for (struct trace_ring *ring = atomic_load(&rings); ring; ring = ring->next) {
+        const char *name = atomic_load_explicit(&ring->name, memory_order_relaxed);
+        unsigned long tid = (unsigned long) ring->thread_id;
+        if (name) {
+            fprintf(file, ",\n{\"name\": \"thread_name\", \"ph\": \"M\", \"pid\": 1, \"tid\": %lu, "
+                          "\"args\": {\"name\": \"%s\"}}", tid, name);
+        }
+        uint skip;
+        uint count = trace_ring_snapshot(ring, events, &skip);
+        for (uint i = skip; i < count; i++) {
+            const struct trace_event *e = events + i;
+            // events from before the trace started may remain if it was restarted mid way through a write
+            if (e->ticks < trace_start_ticks || e->event >= HOST_TRACE_EVENT_COUNT) continue;
+            fprintf(file, ",\n{\"name\": \"%s\", \"ph\": \"%c\", \"ts\": %.3f, \"pid\": 1, \"tid\": %lu%s, "
+                          "\"args\": {\"arg\": %u}}", event_names[e->event], e->phase,
+                    (e->ticks - trace_start_ticks) * us_per_tick, tid, e->phase == 'i' ? ", \"s\": \"t\"" : "",
+                    (uint) e->arg);
+        }
+    }
+    fprintf(file, "\n]}\n");
+    bool ok = !ferror(file);
+    ok &= !fclose(file);
+    free(events);
+    if (ok) printf("Trace written to %s\n", trace_path);
+    return ok;
+}
@@ -4,7 +4,10 @@
  * SPDX-License-Identifier: BSD-3-Clause
  */
 
+#include <math.h>
+#include <stdatomic.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 #include "SDL_image.h"
 #include "SDL_mutex.h"
@@ -17,6 +20,15 @@
 #include "pico/sem.h"
 #include "pico/time.h"
 #include "hardware/sync.h"
+#include "pico/host_core_time.h"
+#include "pico/host_frame_stream.h"
+#include "pico/host_pixel_convert.h"
+#include "pico/host_scanline_record.h"
+#include "pico/host_spin_lock.h"
+#include "pico/host_thread.h"
+#include "pico/host_scaler.h"
+#include "pico/host_trace.h"
+#include "pico/host_video.h"
 
 #undef main
 
@@ -28,7 +40,19 @@ void process_events();
 
 extern int __real_main();
 
-const int surface_pixel_format = SDL_PIXELFORMAT_BGRX8888;
+// sdl_hud.c
+extern volatile bool hud_enabled;
+void hud_record_frame(uint late_scanlines, const uint64_t *wfe_ticks);
+void hud_draw(SDL_Renderer *renderer);
+
+// scanlines whose generation finished after their frame had already been handed to the presenter
+static atomic_uint late_scanlines;
+// performance counter ticks each core has spent blocked in __wfe
+static atomic_uint_fast64_t wfe_ticks[NUM_CORES];
+
+// pico_access_surface holds raw scanvideo pixels (see PICO_SCANVIDEO_PIXEL_RSHIFT etc.), which SDL never reads
+// directly; this format just gives it the right depth. The pixels are converted for presentation by redraw()
+const int surface_pixel_format = SDL_PIXELFORMAT_BGR565;
 
 static char title[128];
 
@@ -78,7 +102,22 @@ SDL_Renderer *renderer;
 SDL_Surface *pico_access_surface;
 SDL_Texture *texture_raw;
 SDL_Texture *texture_blurred;
+SDL_Texture *texture_scaled;
+int texture_scaled_width, texture_scaled_height;
+SDL_RendererInfo renderer_info;
 bool renderer_targettexture_supported;
+bool use_software_scaler;
+
+// the frame converted to a format the renderer takes natively, updated a dirty row at a time
+static Uint32 presentation_sdl_format;
+static host_pixel_convert_fn presentation_convert;
+static uint8_t *presentation_pixels;
+static int presentation_pitch;
+static atomic_uchar *dirty_rows;
+// held by redraw, and by scanvideo_setup_with_timing while it replaces the mode, dirty_rows and surface redraw reads
+static SDL_mutex *video_mode_mutex;
+// set when the mode is set up again, so redraw recreates its textures (and presentation_pixels) at the new size
+static bool textures_stale;
 bool use_correct_aspect_ratio;
 bool force_aspect_ratio = true;
 bool use_integer_scaling;
@@ -92,19 +131,29 @@ const struct scanvideo_pio_program video_24mhz_composable = {
         .id = VIDEO_24MHZ_COMPOSABLE_PROGRAM_NAME
 };
 
-// right now needed on slower Pis
-#if PI_BUILD
-#define COALESCE_SCREEN_UPDATES 1
-#endif
-
-#ifdef COALESCE_SCREEN_UPDATES
-static struct mutex update_screen_mutex;
-static bool update_screen_pending;
+static volatile enum host_frame_pacing frame_pacing = PICO_HOST_SDL_DEFAULT_FRAME_PACING;
+static volatile enum host_av_sync av_sync_mode;
+// log A/V sync measurements (when chosen via the environment)
+static bool av_sync_log;
+// run without a window (or SDL video), e.g. for benchmarks and CI; frames are still produced, streamed and
+// counted as presented, but not drawn. May also be enabled with the PICO_HOST_SDL_HEADLESS environment variable
+#ifndef PICO_HOST_SDL_HEADLESS
+#define PICO_HOST_SDL_HEADLESS 0
 #endif
+static bool headless = PICO_HOST_SDL_HEADLESS;
+
+// set while a DO_UPDATE_SCREEN is queued (or deferred), so later frames can be coalesced into it
+static atomic_bool update_screen_pending;
+static atomic_uint_fast64_t frames_produced;
+static atomic_uint_fast64_t frames_presented;
+static atomic_uint_fast64_t frames_dropped;
+static uint32_t last_present_ms;
 SDL_cond *cpu_event_condition;
 SDL_mutex *cpu_event_mutex;
+// one bit per host_thread_id, so threads other than the cores don't take the cores' events
 volatile uint32_t cpu_event_states;
-SDL_TLSID cpu_core_ids;
+// posted by the vsync timer; a frame can't begin until it has been
+SDL_sem *internal_vsync_sem;
 
 typedef void pio_hw_t;
 
@@ -171,11 +220,8 @@ uint32_t core_scanline_data_linked[NUM_CORES][MAX_LINKED_SCANLINE_BUFFERS][PICO_
 #endif
 
 int core0_thread_func(void *data) {
-    SDL_TLSSet(cpu_core_ids, (void *) 1, 0);
+    host_thread_set_id(HOST_THREAD_CORE0);
     alarm_pool_init_default();
-#ifdef COALESCE_SCREEN_UPDATES
-    mutex_init(&update_screen_mutex);
-#endif
     int rc = __real_main();
     exit(rc);
 }
@@ -193,16 +239,48 @@ int main(int argc, char **argv) {
 #ifdef SDL_HINT_WINDOWS_DISABLE_THREAD_NAMING
     SDL_SetHint(SDL_HINT_WINDOWS_DISABLE_THREAD_NAMING, "1");
 #endif
+    const char *headless_env = getenv("PICO_HOST_SDL_HEADLESS");
+    if (headless_env) headless = strcmp(headless_env, "0") != 0;
     // SDL_INIT_GAMEControLLER seems to cause crash
-    if (SDL_Init(SDL_INIT_VIDEO | SDL_INIT_TIMER/* | SDL_INIT_GAMECONTROLLER*/) != 0) {
+    if (SDL_Init((headless ? SDL_INIT_EVENTS : SDL_INIT_VIDEO) | SDL_INIT_TIMER/* | SDL_INIT_GAMECONTROLLER*/) != 0) {
         assert(false);
     }
-    cpu_core_ids = SDL_TLSCreate();
     cpu_event_mutex = SDL_CreateMutex();
+    video_mode_mutex = SDL_CreateMutex();
     cpu_event_condition = SDL_CreateCond();
 
-    create_window();
-    redraw();
+    const char *frame_stream_address = getenv("PICO_HOST_SDL_FRAME_STREAM");
+    if (frame_stream_address) frame_stream_start(frame_stream_address);
+    const char *pacing = getenv("PICO_HOST_SDL_FRAME_PACING");
+    if (pacing) {
+        if (!strcmp(pacing, "latest")) host_video_set_frame_pacing(HOST_FRAME_PACING_LATEST);
+        else if (!strcmp(pacing, "refresh")) host_video_set_frame_pacing(HOST_FRAME_PACING_REFRESH);
+        else if (!strcmp(pacing, "every")) host_video_set_frame_pacing(HOST_FRAME_PACING_EVERY);
+        else printf("Unknown frame pacing '%s'\n", pacing);
+    }
+    host_thread_set_id(HOST_THREAD_MAIN);
+    const char *trace_path = getenv("PICO_HOST_SDL_TRACE");
+    if (trace_path) host_trace_start(trace_path);
+    const char *core_time_ms = getenv("PICO_HOST_SDL_CORE_TIME_MS");
+    if (core_time_ms) host_core_time_start_log(atoi(core_time_ms));
+    const char *spin_lock_stats = getenv("PICO_HOST_SDL_SPIN_LOCK_STATS");
+    if (spin_lock_stats && strcmp(spin_lock_stats, "0") != 0) atexit(host_spin_lock_print_stats);
+    const char *record_path = getenv("PICO_HOST_SDL_SCANLINE_RECORD");
+    if (record_path) host_video_record_scanlines(record_path);
+    const char *av_sync_env = getenv("PICO_HOST_SDL_AV_SYNC");
+    if (av_sync_env) {
+        av_sync_log = true;
+        if (!strcmp(av_sync_env, "off")) host_video_set_av_sync(HOST_AV_SYNC_OFF);
+        else if (!strcmp(av_sync_env, "measure")) host_video_set_av_sync(HOST_AV_SYNC_MEASURE);
+        else if (!strcmp(av_sync_env, "follow")) host_video_set_av_sync(HOST_AV_SYNC_FOLLOW_AUDIO);
+        else printf("Unknown A/V sync mode '%s'\n", av_sync_env);
+    }
+
+    internal_vsync_sem = SDL_CreateSemaphore(0);
+    if (!headless) {
+        create_window();
+        redraw();
+    }
 
     __unused SDL_Thread *core0_thread = SDL_CreateThread(core0_thread_func, "Core 0", 0);
 
@@ -211,7 +289,7 @@ int main(int argc, char **argv) {
 }
 
 int core1_thread_func(void *entry) {
-    SDL_TLSSet(cpu_core_ids, (void *) 2, 0);
+    host_thread_set_id(HOST_THREAD_CORE1);
     // todo locking and cleanup
     ((void (*)(void)) entry)();
     return 0;
@@ -221,15 +299,27 @@ bool scanvideo_setup(const struct scanvideo_mode *mode) {
     return scanvideo_setup_with_timing(mode, NULL);
 }
 
+void host_video_set_frame_pacing(enum host_frame_pacing pacing) {
+    frame_pacing = pacing;
+}
+
+enum host_frame_pacing host_video_get_frame_pacing(void) {
+    return frame_pacing;
+}
+
+void host_video_get_frame_stats(struct host_frame_stats *stats) {
+    stats->produced = atomic_load(&frames_produced);
+    stats->presented = atomic_load(&frames_presented);
+    stats->dropped = atomic_load(&frames_dropped);
+}
+
 void send_update_screen() {
-#ifdef COALESCE_SCREEN_UPDATES
-    bool needed = false;
-    mutex_enter_blocking(&update_screen_mutex);
-    if (!update_screen_pending) needed = true;
-    update_screen_pending = true;
-    mutex_exit(&update_screen_mutex);
-    if (!needed) return;
-#endif
+    atomic_fetch_add_explicit(&frames_produced, 1, memory_order_relaxed);
+    if (frame_pacing != HOST_FRAME_PACING_EVERY && atomic_exchange(&update_screen_pending, true)) {
+        // the queued update will show this frame instead of the last one
+        atomic_fetch_add_explicit(&frames_dropped, 1, memory_order_relaxed);
+        return;
+    }
     SDL_Event event;
     memset(&event, 0, sizeof(event));
     event.type = SDL_USEREVENT;
@@ -269,10 +359,106 @@ void scanvideo_set_simulate_composable_cmd(uint cmd, simulate_composable_cmd_fn
 }
 
 SDL_TimerID vsync_timer;
+static uint32_t vsync_delay_ms;
+
+// A/V sync state, updated by the vsync timer
+#define AV_SYNC_WINDOW_US 1000000
+// fraction of the offset corrected per second when following audio, and the most the vsync period is changed by
+#define AV_SYNC_SLEW_GAIN 0.1
+#define AV_SYNC_MAX_SLEW 0.005
+
+bool (*host_video_audio_clock_fn)(uint64_t *us);
+static SDL_SpinLock av_sync_lock;
+static struct {
+    bool aligned;
+    uint64_t frames;          // vsyncs since the clocks were aligned
+    uint64_t audio_origin_us;
+    uint64_t window_frames;   // frames and audio clock at the start of the current measurement window
+    uint64_t window_audio_us;
+    double slew;
+    double next_vsync_ticks;  // when following audio, when the next vsync is due
+    struct host_av_sync_stats stats;
+} av_sync;
+
+void host_video_set_av_sync(enum host_av_sync mode) {
+    SDL_AtomicLock(&av_sync_lock);
+    av_sync_mode = mode;
+    av_sync.aligned = false;
+    av_sync.slew = 0;
+    av_sync.next_vsync_ticks = 0;
+    memset(&av_sync.stats, 0, sizeof(av_sync.stats));
+    SDL_AtomicUnlock(&av_sync_lock);
+}
+
+enum host_av_sync host_video_get_av_sync(void) {
+    return av_sync_mode;
+}
+
+bool host_video_get_av_sync_stats(struct host_av_sync_stats *stats) {
+    SDL_AtomicLock(&av_sync_lock);
+    bool aligned = av_sync.aligned;
+    *stats = av_sync.stats;
+    SDL_AtomicUnlock(&av_sync_lock);
+    return aligned;
+}
+
+static void av_sync_vsync(void) {
+    uint64_t audio_us;
+    // the clocks are aligned once audio is actually playing
+    if (!host_video_audio_clock_fn || !host_video_audio_clock_fn(&audio_us) || !audio_us) return;
+    bool window_done = false;
+    struct host_av_sync_stats stats;
+    SDL_AtomicLock(&av_sync_lock);
+    if (!av_sync.aligned) {
+        av_sync.aligned = true;
+        av_sync.frames = av_sync.window_frames = 0;
+        av_sync.audio_origin_us = av_sync.window_audio_us = audio_us;
+    } else {
+        av_sync.frames++;
+    }
+    double video_us = (double) av_sync.frames * 1000000.0 / vsync_freq;
+    int64_t offset_us = (int64_t) llround(video_us - (double) (audio_us - av_sync.audio_origin_us));
+    av_sync.stats.offset_us = offset_us;
+    if (llabs(offset_us) > llabs(av_sync.stats.max_offset_us)) av_sync.stats.max_offset_us = offset_us;
+    if (audio_us - av_sync.window_audio_us >= AV_SYNC_WINDOW_US) {
+        double window_video_us = (double) (av_sync.frames - av_sync.window_frames) * 1000000.0 / vsync_freq;
+        double window_audio_us = (double) (audio_us - av_sync.window_audio_us);
+        av_sync.stats.drift_ppm = (window_video_us - window_audio_us) * 1000000.0 / window_audio_us;
+        av_sync.stats.seconds++;
+        av_sync.window_frames = av_sync.frames;
+        av_sync.window_audio_us = audio_us;
+        window_done = true;
+    }
+    if (av_sync_mode == HOST_AV_SYNC_FOLLOW_AUDIO) {
+        // lengthen the vsync period while video is ahead, and shorten it while behind
+        av_sync.slew = fmin(fmax(offset_us / 1000000.0 * AV_SYNC_SLEW_GAIN, -AV_SYNC_MAX_SLEW), AV_SYNC_MAX_SLEW);
+        av_sync.stats.slew_ppm = av_sync.slew * 1000000.0;
+    }
+    stats = av_sync.stats;
+    SDL_AtomicUnlock(&av_sync_lock);
+    if (window_done && av_sync_log) {
+        printf("A/V: video %+.1fms vs audio (max %+.1fms), drift %+.0fppm, vsync slew %+.0fppm\n",
+               stats.offset_us / 1000.0, stats.max_offset_us / 1000.0, stats.drift_ppm, stats.slew_ppm);
+    }
+}
 
-SDL_sem *internal_vsync_sem;
+// when following audio, vsyncs are scheduled at exactly the (slewed) refresh rate rather than the whole number of
+// milliseconds the timer otherwise runs at
+static Uint32 av_sync_vsync_interval(void) {
+    double now = (double) SDL_GetPerformanceCounter();
+    double freq = (double) SDL_GetPerformanceFrequency();
+    double period = freq / vsync_freq * (1.0 + av_sync.slew);
+    // first time, or too far behind to catch up
+    if (!av_sync.next_vsync_ticks || now > av_sync.next_vsync_ticks + period) av_sync.next_vsync_ticks = now;
+    av_sync.next_vsync_ticks += period;
+    double ms = (av_sync.next_vsync_ticks - now) * 1000.0 / freq;
+    return ms < 1.0 ? 1 : (Uint32) lround(ms);
+}
 
 Uint32 vsync_callback(Uint32 interval, void *param) {
+    // SDL runs every timer callback on the one thread
+    host_thread_set_id(HOST_THREAD_TIMER);
+    host_trace_instant(HOST_TRACE_VBLANK, 0);
     // todo this is a bit dodgy, but at worst we wait for the next sem
     if (!SDL_SemValue(internal_vsync_sem)) {
         SDL_SemPost(internal_vsync_sem);
@@ -284,7 +470,12 @@ Uint32 vsync_callback(Uint32 interval, void *param) {
     event.user.code = DO_VSYNC;
     event.user.data1 = param;
     SDL_PushEvent(&event);
-    return interval;
+
+    if (av_sync_mode != HOST_AV_SYNC_OFF) {
+        av_sync_vsync();
+        if (av_sync_mode == HOST_AV_SYNC_FOLLOW_AUDIO) return av_sync_vsync_interval();
+    }
+    return vsync_delay_ms;
 }
 
 struct scanvideo_mode scanvideo_get_mode() {
@@ -298,8 +489,10 @@ extern void scanvideo_timing_enable(bool enable) {
                 assert(false);
             }
         }
-        uint32_t delay_ms = (uint32_t) (1000.0 / vsync_freq);
-        vsync_timer = SDL_AddTimer(delay_ms, vsync_callback, NULL);
+        vsync_delay_ms = (uint32_t) (1000.0 / vsync_freq);
+        // realign the clocks, as the video clock restarts here
+        host_video_set_av_sync(av_sync_mode);
+        vsync_timer = SDL_AddTimer(vsync_delay_ms, vsync_callback, NULL);
         if (vsync_timer == 0) {
             assert(false);
         }
@@ -448,7 +641,122 @@ void simulate_scanvideo_pio_video_24mhz_composable(const uint32_t *dma_data, uin
     assert(last_was_black);
 }
 
+// Scanline recording (see host_scanline_record.h). The writer is only swapped or used under scanline_record_lock;
+// the record itself is built by scanvideo_end_scanline_generation, under scanline_mutex
+static struct host_scanline_writer *scanline_writer;
+static SDL_SpinLock scanline_record_lock;
+static bool scanline_record_mode_pending;
+static struct host_scanline_record scanline_record;
+// copies of each segment's plane data, as the merge buffers are reused for the next segment
+static uint32_t *scanline_record_words;
+static uint64_t scanline_record_ticks;
+// whether a truncated scanline has been reported for this recording
+static bool scanline_record_truncation_reported;
+
+static void scanline_record_stop(void) {
+    host_video_record_scanlines(NULL);
+}
+
+bool host_video_record_scanlines(const char *path) {
+    struct host_scanline_writer *writer = NULL;
+    if (path) {
+        if (!scanline_record_words) {
+            scanline_record_words = malloc(PICO_HOST_SCANLINE_RECORD_MAX_SEGMENTS * PICO_HOST_SCANLINE_RECORD_MAX_PLANES *
+                                           PICO_HOST_SCANLINE_RECORD_MAX_WORDS * sizeof(uint32_t));
+        }
+        writer = scanline_record_words ? host_scanline_writer_open(path) : NULL;
+        if (!writer) {
+            printf("Error: can't record scanlines to %s\n", path);
+            return false;
+        }
+        static bool registered;
+        if (!registered) {
+            registered = true;
+            atexit(scanline_record_stop);
+        }
+    }
+    SDL_AtomicLock(&scanline_record_lock);
+    struct host_scanline_writer *old_writer = scanline_writer;
+    scanline_writer = writer;
+    scanline_record_mode_pending = true;
+    scanline_record_ticks = 0;
+    scanline_record_truncation_reported = false;
+    SDL_AtomicUnlock(&scanline_record_lock);
+    host_scanline_writer_close(old_writer);
+    return true;
+}
+
+static void scanline_record_begin(uint32_t scanline_id, uint repeat_count) {
+    scanline_record.scanline_id = scanline_id;
+    scanline_record.repeat_count = (uint16_t) repeat_count;
+    scanline_record.plane_count = PICO_SCANVIDEO_PLANE_COUNT;
+    scanline_record.segment_count = 0;
+    scanline_record.flags = 0;
+}
+
+static void scanline_record_truncated(const char *what) {
+    scanline_record.flags |= PICO_HOST_SCANLINE_RECORD_TRUNCATED;
+    if (!scanline_record_truncation_reported) {
+        scanline_record_truncation_reported = true;
+        printf("Warning: scanline %08x has %s than can be recorded; it (and any others) will be marked truncated\n",
+               (uint) scanline_record.scanline_id, what);
+    }
+}
+
+// returns NULL (so the segment isn't recorded) if there are already too many
+static struct host_scanline_record_segment *scanline_record_add_segment(uint rows) {
+    if (scanline_record.segment_count == PICO_HOST_SCANLINE_RECORD_MAX_SEGMENTS) {
+        scanline_record_truncated("more linked buffers");
+        return NULL;
+    }
+    struct host_scanline_record_segment *segment = scanline_record.segments + scanline_record.segment_count++;
+    segment->rows = (uint16_t) rows;
+    return segment;
+}
+
+static void scanline_record_plane(struct host_scanline_record_segment *segment, uint plane, const uint32_t *data,
+                                  uint data_used) {
+    uint index = (segment - scanline_record.segments) * PICO_HOST_SCANLINE_RECORD_MAX_PLANES + plane;
+    uint32_t *words = scanline_record_words + index * PICO_HOST_SCANLINE_RECORD_MAX_WORDS;
+    if (data_used > PICO_HOST_SCANLINE_RECORD_MAX_WORDS) {
+        scanline_record_truncated("more plane data");
+        data_used = PICO_HOST_SCANLINE_RECORD_MAX_WORDS;
+    }
+    memcpy(words, data, data_used * sizeof(uint32_t));
+    segment->words[plane] = words;
+    segment->word_count[plane] = (uint16_t) data_used;
+}
+
+static void scanline_record_end(void) {
+    uint64_t now = SDL_GetPerformanceCounter();
+    SDL_AtomicLock(&scanline_record_lock);
+    if (scanline_writer) {
+        if (scanline_record_mode_pending) {
+            struct host_scanline_record_mode mode = {
+                    .width = video_mode.width,
+                    .height = video_mode.height,
+                    .xscale = video_mode.xscale,
+                    .yscale = video_mode.yscale,
+                    .yscale_denominator = video_mode.yscale_denominator,
+                    .clock_freq = timing.clock_freq,
+                    .h_active = timing.h_active,
+                    .v_active = timing.v_active,
+                    .h_total = timing.h_total,
+                    .v_total = timing.v_total,
+            };
+            host_scanline_writer_write_mode(scanline_writer, &mode);
+            scanline_record_mode_pending = false;
+        }
+        uint64_t delta_us = scanline_record_ticks ? (now - scanline_record_ticks) * 1000000 / SDL_GetPerformanceFrequency() : 0;
+        scanline_record.delta_us = (uint32_t) MIN(delta_us, UINT32_MAX);
+        scanline_record_ticks = now;
+        host_scanline_writer_write_scanline(scanline_writer, &scanline_record);
+    }
+    SDL_AtomicUnlock(&scanline_record_lock);
+}
+
 bool scanvideo_setup_with_timing(const struct scanvideo_mode *mode, const struct scanvideo_timing *timing_override) {
+    SDL_LockMutex(video_mode_mutex);
     video_mode = *mode;
     if (!video_mode.yscale_denominator) video_mode.yscale_denominator = 1;
     assert(video_mode.yscale >= video_mode.yscale_denominator);
@@ -460,11 +768,20 @@ bool scanvideo_setup_with_timing(const struct scanvideo_mode *mode, const struct
     last_scanline_id = -1;
     screen_rect.right = video_mode.width;
     screen_rect.bottom = timing.v_active;
+    // reused when the number of rows hasn't changed, e.g. when a replay sets up the same mode again
+    static uint dirty_rows_count;
+    if (!dirty_rows || dirty_rows_count != timing.v_active) {
+        free(dirty_rows);
+        dirty_rows = calloc(timing.v_active, sizeof(atomic_uchar));
+        dirty_rows_count = timing.v_active;
+    }
+    textures_stale = video_mode_valid;
     video_mode_valid = true;
     vsync_freq = ((double) timing.clock_freq) / (timing.h_total * timing.v_total);
     pico_access_surface = SDL_CreateRGBSurfaceWithFormat(0, screen_rect.right, screen_rect.bottom, 16,
                                                          surface_pixel_format);
     assert (pico_access_surface);
+    SDL_UnlockMutex(video_mode_mutex);
     for (int i = 0; i < NUM_CORES; i++) {
         core_scanline_pixel_buffer[i] = calloc(video_mode.width + ALLOWED_PIXEL_OVERRUN, sizeof(uint16_t));
     }
@@ -490,6 +807,7 @@ bool scanvideo_setup_with_timing(const struct scanvideo_mode *mode, const struct
     }
 #endif
 
+    scanline_record_mode_pending = true;
     printf("VSync freq %g\n", vsync_freq);
     if (!strcmp(mode->pio_program->id, VIDEO_24MHZ_COMPOSABLE_PROGRAM_NAME))
         current_simulate_scanvideo_pio_fn = simulate_scanvideo_pio_video_24mhz_composable;
@@ -506,20 +824,28 @@ struct scanvideo_scanline_buffer *scanvideo_begin_scanline_generation_linked(uin
     struct full_scanvideo_scanline_buffer *fsb = core_scaneline_buffers + core;
     mutex_enter_blocking(&scanline_mutex);
     uint32_t next_scanline_id = scanline_id_after(last_scanline_id);
+    bool frame_completed = scanvideo_frame_number(next_scanline_id) != scanvideo_frame_number(last_scanline_id);
+    uint32_t completed_frame_number = scanvideo_frame_number(last_scanline_id);
 
-    if (scanvideo_frame_number(next_scanline_id) != scanvideo_frame_number(last_scanline_id)) {
+    if (frame_completed) {
         if (!block) {
             if (0 != SDL_SemTryWait(internal_vsync_sem)) {
                 mutex_exit(&scanline_mutex);
                 return NULL;
             }
         } else {
+            enum host_core_time_state previous = host_core_time_enter(HOST_CORE_TIME_SEMAPHORE);
             SDL_SemWait(internal_vsync_sem);
+            host_core_time_leave(previous);
         }
+        uint64_t ticks[NUM_CORES];
+        for (int i = 0; i < NUM_CORES; i++) ticks[i] = atomic_load(&wfe_ticks[i]);
+        hud_record_frame(atomic_exchange(&late_scanlines, 0), ticks);
         send_update_screen();
         sem_release(&vblank_begin);
     }
     fsb->core.scanline_id = last_scanline_id = next_scanline_id;
+    host_trace_begin(HOST_TRACE_SCANLINE, next_scanline_id);
     scanline_buffer_in_use[core] = true;
 #if PICO_SCANVIDEO_LINKED_SCANLINE_BUFFERS
     assert(n <= MAX_LINKED_SCANLINE_BUFFERS);
@@ -532,6 +858,11 @@ struct scanvideo_scanline_buffer *scanvideo_begin_scanline_generation_linked(uin
     }
 #endif
     mutex_exit(&scanline_mutex);
+    // copied outside the mutex, so the other core isn't held up while a viewer is attached
+    if (frame_completed) {
+        frame_stream_submit_frame(pico_access_surface->pixels, pico_access_surface->pitch, video_mode.width,
+                                  timing.v_active, completed_frame_number);
+    }
     sem_release(&hblank_begin);
     return &fsb->core;
 }
@@ -555,13 +886,17 @@ uint32_t scanvideo_wait_for_scanline_complete(uint32_t scanline_id) {
     uint32_t next_scanline_id;
     // scanline_id > video_get_next_scanline_id() but with wrapping support
     while (0 < (int32_t) (scanline_id - (next_scanline_id = scanvideo_get_next_scanline_id()))) {
+        enum host_core_time_state previous = host_core_time_enter(HOST_CORE_TIME_SEMAPHORE);
         sem_acquire_blocking(&hblank_begin);
+        host_core_time_leave(previous);
     }
     return next_scanline_id;
 }
 
 void scanvideo_wait_for_vblank() {
+    enum host_core_time_state previous = host_core_time_enter(HOST_CORE_TIME_SEMAPHORE);
     sem_acquire_blocking(&vblank_begin);
+    host_core_time_leave(previous);
 }
 
 uint32_t host_safe_hw_ptr_impl(uintptr_t x) {
@@ -621,6 +956,8 @@ void scanvideo_end_scanline_generation(struct scanvideo_scanline_buffer *scanlin
     assert(scanline_buffer_in_use[core]);
     assert(scanline_buffer == &(core_scaneline_buffers + core)->core);
     struct full_scanvideo_scanline_buffer *fsb = (struct full_scanvideo_scanline_buffer *) scanline_buffer;
+    bool recording = scanline_writer != NULL;
+    uint repeat_count;
 
     // graham 7/24/20 moved this from being scanline generation to better match on device where the repeat
     // count function isn't called until after the scanline is generated
@@ -632,18 +969,23 @@ void scanvideo_end_scanline_generation(struct scanvideo_scanline_buffer *scanlin
             accum = 0;
         }
         fsb->screen_y = screen_y;
+        repeat_count = _scanline_repeat_count_fn(scanline_buffer->scanline_id);
         int multiplier = 0;
         do {
             multiplier++;
             accum += video_mode.yscale_denominator;
         } while (accum < video_mode.yscale);
         accum -= video_mode.yscale;
-        fsb->screen_height = _scanline_repeat_count_fn(scanline_buffer->scanline_id) * multiplier;
+        fsb->screen_height = repeat_count * multiplier;
         screen_y += fsb->screen_height;
 
     }
     // note plus one for black pixel
     mutex_enter_blocking(&scanline_mutex);
+    if (recording) scanline_record_begin(scanline_buffer->scanline_id, repeat_count);
+    if (scanvideo_frame_number(scanline_buffer->scanline_id) != scanvideo_frame_number(last_scanline_id)) {
+        atomic_fetch_add(&late_scanlines, 1);
+    }
 
     uint16_t *pixels = (uint16_t *) ((uint8_t *) pico_access_surface->pixels + pico_access_surface->pitch * fsb->screen_y);
     bool need_new_row = true;
@@ -653,6 +995,14 @@ void scanvideo_end_scanline_generation(struct scanvideo_scanline_buffer *scanlin
             break;
         }
         if (need_new_row) {
+            struct host_scanline_record_segment *segment = NULL;
+            if (recording) {
+#if PICO_SCANVIDEO_LINKED_SCANLINE_BUFFERS
+                segment = scanline_record_add_segment(scanline_buffer->link_after);
+#else
+                segment = scanline_record_add_segment(0);
+#endif
+            }
             uint32_t *data = scanline_buffer->data;
             int data_used = scanline_buffer->data_used;
             int expected_width = video_mode.width;
@@ -668,6 +1018,7 @@ void scanvideo_end_scanline_generation(struct scanvideo_scanline_buffer *scanlin
     data = buf;
     expected_width = 0; // for now don't assert on width for this
 #endif
+            if (segment) scanline_record_plane(segment, 0, data, data_used);
             current_simulate_scanvideo_pio_fn(data, data_used, core_scanline_pixel_buffer[core],
                                               video_mode.width + ALLOWED_PIXEL_OVERRUN, expected_width, false);
 #if PICO_SCANVIDEO_PLANE_COUNT > 1
@@ -680,14 +1031,17 @@ void scanvideo_end_scanline_generation(struct scanvideo_scanline_buffer *scanlin
     data = buf2;
     expected_width = 0; // for now don't assert on width for this
 #endif
+            if (segment) scanline_record_plane(segment, 1, data, data_used);
             current_simulate_scanvideo_pio_fn(data, data_used, core_scanline_pixel_buffer[core], video_mode.width, expected_width, true);
 #if PICO_SCANVIDEO_PLANE_COUNT > 2
+            if (segment) scanline_record_plane(segment, 2, scanline_buffer->data3, scanline_buffer->data3_used);
             current_simulate_scanvideo_pio_fn(scanline_buffer->data3, scanline_buffer->data3_used, core_scanline_pixel_buffer[core], video_mode.width, 0, true);
 #endif
 #endif
             need_new_row = false;
         }
         memcpy(pixels, core_scanline_pixel_buffer[core], video_mode.width * sizeof(uint16_t));
+        atomic_store_explicit(&dirty_rows[fsb->screen_y + i], 1, memory_order_release);
         pixels = (uint16_t *) (((uint8_t *) pixels) + pico_access_surface->pitch);
 #if PICO_SCANVIDEO_LINKED_SCANLINE_BUFFERS
         if (scanline_buffer->link_after) {
@@ -699,8 +1053,10 @@ void scanvideo_end_scanline_generation(struct scanvideo_scanline_buffer *scanlin
         }
 #endif
     }
+    if (recording) scanline_record_end();
     mutex_exit(&scanline_mutex);
     scanline_buffer_in_use[core] = false;
+    host_trace_end(HOST_TRACE_SCANLINE, fsb->core.scanline_id);
 }
 
 void window_resized() {
@@ -737,12 +1093,55 @@ void apply_aspect_ratio() {
     window_resized();
 }
 
+static void choose_presentation_format() {
+    enum host_pixel_format format = HOST_PIXEL_FORMAT_BGRX8888;
+    presentation_sdl_format = SDL_PIXELFORMAT_ARGB8888;
+    if (use_software_scaler) {
+        // the scaler works in 5:6:5
+        format = HOST_PIXEL_FORMAT_RGB565;
+        presentation_sdl_format = SDL_PIXELFORMAT_RGB565;
+    } else {
+        // take the first format in the renderer's (preference ordered) list that we can convert to, so SDL
+        // doesn't need to convert again on upload
+        for (uint i = 0; i < renderer_info.num_texture_formats; i++) {
+            Uint32 f = renderer_info.texture_formats[i];
+            if (f == SDL_PIXELFORMAT_ARGB8888 || f == SDL_PIXELFORMAT_RGB888) {
+                format = HOST_PIXEL_FORMAT_BGRX8888;
+            } else if (f == SDL_PIXELFORMAT_ABGR8888 || f == SDL_PIXELFORMAT_BGR888) {
+                format = HOST_PIXEL_FORMAT_RGBX8888;
+            } else if (f == SDL_PIXELFORMAT_RGB565) {
+                format = HOST_PIXEL_FORMAT_RGB565;
+            } else {
+                continue;
+            }
+            presentation_sdl_format = f;
+            break;
+        }
+    }
+    presentation_convert = host_pixel_convert_get(format);
+    presentation_pitch = (int) (video_mode.width * host_pixel_format_bytes_per_pixel(format));
+    free(presentation_pixels);
+    presentation_pixels = calloc(timing.v_active, presentation_pitch);
+}
+
 void check_textures() {
+    if (textures_stale) {
+        // the mode has changed size; the textures are recreated below, and presentation_pixels with them
+        if (texture_raw) SDL_DestroyTexture(texture_raw);
+        if (texture_scaled) SDL_DestroyTexture(texture_scaled);
+        if (texture_blurred) SDL_DestroyTexture(texture_blurred);
+        texture_raw = texture_scaled = texture_blurred = NULL;
+        textures_stale = false;
+    }
     if (texture_raw == NULL) {
         apply_aspect_ratio();
-        texture_raw = SDL_CreateTexture(renderer, SDL_PIXELFORMAT_BGR565, SDL_TEXTUREACCESS_STREAMING,
+        choose_presentation_format();
+        texture_raw = SDL_CreateTexture(renderer, presentation_sdl_format, SDL_TEXTUREACCESS_STREAMING,
                                         video_mode.width, timing.v_active);
         printf("tr %p\n", texture_raw);
+        for (int y = 0; y < timing.v_active; y++) {
+            atomic_store_explicit(&dirty_rows[y], 1, memory_order_relaxed);
+        }
     }
 #if PICO_SCANVIDEO_SCALING_BLUR
     int effective_width = video_mode.width * video_mode.xscale;
@@ -750,7 +1149,7 @@ void check_textures() {
     if (texture_blurred == NULL) {
         SDL_SetHint(SDL_HINT_RENDER_SCALE_QUALITY, "2");
         int access = renderer_targettexture_supported ? SDL_TEXTUREACCESS_TARGET : SDL_TEXTUREACCESS_STREAMING;
-        texture_blurred = SDL_CreateTexture(renderer, surface_pixel_format, access, effective_width,
+        texture_blurred = SDL_CreateTexture(renderer, presentation_sdl_format, access, effective_width,
                                             effective_height);
         SDL_SetHint(SDL_HINT_RENDER_SCALE_QUALITY, "0");
     }
@@ -1316,7 +1715,6 @@ const uint8_t icon_bytes[] = {
 };
 
 void create_window() {
-    internal_vsync_sem = SDL_CreateSemaphore(0);
     Uint32 flags = 0;
     flags |= SDL_WINDOW_RESIZABLE;
     flags |= SDL_WINDOW_ALLOW_HIGHDPI; 
@@ -1352,11 +1750,24 @@ void create_window() {
 
     SDL_SetHint(SDL_HINT_RENDER_VSYNC, "0");
     renderer = SDL_CreateRenderer(window, -1, SDL_RENDERER_ACCELERATED | SDL_RENDERER_TARGETTEXTURE);
-    SDL_RendererInfo renderer_info;
     if (SDL_GetRendererInfo(renderer, &renderer_info) == 0) {
         if (renderer_info.flags & SDL_RENDERER_TARGETTEXTURE) {
             renderer_targettexture_supported = true;
         }
+        if (renderer_info.flags & SDL_RENDERER_SOFTWARE) {
+            use_software_scaler = true;
+        }
+    }
+    if (!renderer_targettexture_supported) {
+        use_software_scaler = true;
+    }
+    const char *scaler = getenv("PICO_HOST_SDL_SCALER");
+    if (scaler) {
+        if (!strcmp(scaler, "nearest")) host_scaler_set_filter(HOST_SCALER_NEAREST);
+        else if (!strcmp(scaler, "bilinear")) host_scaler_set_filter(HOST_SCALER_BILINEAR);
+        else if (!strcmp(scaler, "scale2x")) host_scaler_set_filter(HOST_SCALER_SCALE2X);
+        else printf("Unknown scaler '%s'\n", scaler);
+        use_software_scaler = true;
     }
 
     if (use_integer_scaling) {
@@ -1370,14 +1781,78 @@ void create_window() {
     window_resized();
 }
 
+// scale the frame on the CPU straight into a streaming texture the size of the viewport, so the final copy
+// by the renderer is 1:1
+static SDL_Texture *software_scale(bool frame_changed) {
+    int output_width, output_height;
+    SDL_GetRendererOutputSize(renderer, &output_width, &output_height);
+    int logical_width, logical_height;
+    SDL_RenderGetLogicalSize(renderer, &logical_width, &logical_height);
+    int width = output_width;
+    int height = output_height;
+    if (logical_width && logical_height) {
+        // match the viewport SDL letterboxes the logical size into
+        double scale_x = (double) output_width / logical_width;
+        double scale_y = (double) output_height / logical_height;
+        double scale = scale_x < scale_y ? scale_x : scale_y;
+        if (use_integer_scaling && scale >= 1) scale = floor(scale);
+        width = (int) (logical_width * scale);
+        height = (int) (logical_height * scale);
+    }
+    if (width <= 0 || height <= 0) return NULL;
+    if (!texture_scaled || width != texture_scaled_width || height != texture_scaled_height) {
+        if (texture_scaled) SDL_DestroyTexture(texture_scaled);
+        SDL_SetHint(SDL_HINT_RENDER_SCALE_QUALITY, "0");
+        texture_scaled = SDL_CreateTexture(renderer, presentation_sdl_format, SDL_TEXTUREACCESS_STREAMING, width,
+                                           height);
+        texture_scaled_width = width;
+        texture_scaled_height = height;
+        if (!texture_scaled) return NULL;
+    } else if (!frame_changed) {
+        return texture_scaled;
+    }
+    void *pixels;
+    int pitch;
+    if (SDL_LockTexture(texture_scaled, NULL, &pixels, &pitch)) return NULL;
+    host_scaler_scale((const uint16_t *) presentation_pixels, presentation_pitch, video_mode.width, timing.v_active,
+                      pixels, pitch, width, height);
+    SDL_UnlockTexture(texture_scaled);
+    return texture_scaled;
+}
+
+// convert the rows written since the last call in a single pass, returning the range of rows converted
+static bool update_presentation_pixels(SDL_Surface *surface, int *first_row, int *last_row) {
+    int first = -1, last = -1;
+    for (int y = 0; y < timing.v_active; y++) {
+        // clear before reading, so a row being rewritten concurrently is converted again next time
+        if (atomic_exchange_explicit(&dirty_rows[y], 0, memory_order_acquire)) {
+            presentation_convert((const uint16_t *) ((const uint8_t *) surface->pixels + y * surface->pitch),
+                                 presentation_pixels + y * presentation_pitch, video_mode.width);
+            if (first < 0) first = y;
+            last = y;
+        }
+    }
+    *first_row = first;
+    *last_row = last;
+    return first >= 0;
+}
+
 void redraw() {
     SDL_Texture *draw_texture = NULL;
+    SDL_LockMutex(video_mode_mutex);
     if (video_mode_valid) {
         check_textures();
         SDL_Surface *surface = pico_access_surface;
+        int first_row, last_row;
         // there can be a race with the creation of pico_access_surface which is done by SDK api
-        if (surface) {
-            SDL_UpdateTexture(texture_raw, NULL, surface->pixels, surface->pitch);
+        if (surface && use_software_scaler) {
+            draw_texture = software_scale(update_presentation_pixels(surface, &first_row, &last_row));
+        } else if (surface) {
+            if (update_presentation_pixels(surface, &first_row, &last_row)) {
+                SDL_Rect rect = {0, first_row, video_mode.width, last_row + 1 - first_row};
+                SDL_UpdateTexture(texture_raw, &rect, presentation_pixels + first_row * presentation_pitch,
+                                  presentation_pitch);
+            }
             if (renderer_targettexture_supported && PICO_SCANVIDEO_SCALING_BLUR) {
 #if PICO_SCANVIDEO_SCALING_NEAREST
                 SDL_SetHint(SDL_HINT_RENDER_SCALE_QUALITY, "0");
@@ -1397,6 +1872,8 @@ void redraw() {
     }
     SDL_RenderClear(renderer);
     if (draw_texture) SDL_RenderCopy(renderer, draw_texture, NULL, NULL);
+    SDL_UnlockMutex(video_mode_mutex);
+    hud_draw(renderer);
     SDL_RenderPresent(renderer);
 }
 
@@ -1411,6 +1888,23 @@ void toggle_fullscreen() {
     }
 }
 
+static int display_refresh_rate() {
+    SDL_DisplayMode mode;
+    if (SDL_GetWindowDisplayMode(window, &mode) == 0 && mode.refresh_rate > 0) {
+        return mode.refresh_rate;
+    }
+    return 60;
+}
+
+static Uint32 deferred_update_screen_callback(Uint32 interval, void *param) {
+    SDL_Event event;
+    memset(&event, 0, sizeof(event));
+    event.type = SDL_USEREVENT;
+    event.user.code = DO_UPDATE_SCREEN;
+    SDL_PushEvent(&event);
+    return 0;
+}
+
 void process_events() {
     SDL_Event event;
     while (SDL_WaitEvent(&event)) {
@@ -1431,6 +1925,19 @@ void process_events() {
                         toggle_fullscreen();
                         key_states[scancode] = 1;
                     }
+                } else if ((modifier & KMOD_ALT) &&
+                           scancode == SDL_SCANCODE_H) {
+                    if (key_states[scancode] == 0) {
+                        hud_enabled = !hud_enabled;
+                        key_states[scancode] = 1;
+                        redraw();
+                    }
+                } else if ((modifier & KMOD_ALT) &&
+                           scancode == SDL_SCANCODE_T) {
+                    if (key_states[scancode] == 0) {
+                        if (host_trace_enabled) host_trace_dump();
+                        key_states[scancode] = 1;
+                    }
                 } else {
                     key_states[scancode] = 1;
                     if (platform_key_down)
@@ -1454,12 +1961,20 @@ void process_events() {
                 break;
             case SDL_USEREVENT:
                 if (event.user.code == DO_UPDATE_SCREEN) {
-#ifdef COALESCE_SCREEN_UPDATES
-                    mutex_enter_blocking(&update_screen_mutex);
-                    update_screen_pending = false;
-                    mutex_exit(&update_screen_mutex);
-#endif
-                    redraw();
+                    if (frame_pacing == HOST_FRAME_PACING_REFRESH) {
+                        uint32_t period_ms = 1000 / display_refresh_rate();
+                        uint32_t elapsed_ms = SDL_GetTicks() - last_present_ms;
+                        if (elapsed_ms < period_ms) {
+                            // leave update_screen_pending set, so frames completed until then are coalesced
+                            SDL_AddTimer(period_ms - elapsed_ms, deferred_update_screen_callback, NULL);
+                            break;
+                        }
+                    }
+                    last_present_ms = SDL_GetTicks();
+                    // clear before drawing, so a frame completed during the redraw gets its own update
+                    atomic_store(&update_screen_pending, false);
+                    atomic_fetch_add_explicit(&frames_presented, 1, memory_order_relaxed);
+                    if (!headless) redraw();
                 }
                 break;
             case SDL_MOUSEBUTTONDOWN:
@@ -1523,11 +2038,10 @@ void multicore_lockout_end_blocking() {
     panic_unsupported();
 }
 
+// threads other than the cores (e.g. timer callbacks, standing in for IRQs) run as core 0
 uint get_core_num() {
-    int core = ((int) (intptr_t) SDL_TLSGet(cpu_core_ids)) - 1;
-    //assert(core>=0 && core<NUM_CORES);
-    if (core == -1) core = 0; // hack
-    return core;
+    uint id = host_thread_current;
+    return id < NUM_CORES ? id : 0;
 }
 
 
@@ -1535,12 +2049,40 @@ uint32_t platform_clk_hz(void) {
     panic_unsupported();
 }
 
+// waiters spin for this many pause instructions per place they are behind in the queue before checking again
+#ifndef PICO_HOST_SPIN_LOCK_BACKOFF_PAUSES
+#define PICO_HOST_SPIN_LOCK_BACKOFF_PAUSES 16
+#endif
+
+// after this many checks a waiter also yields its host CPU, in case the holder's thread isn't running
+#ifndef PICO_HOST_SPIN_LOCK_YIELD_SPINS
+#define PICO_HOST_SPIN_LOCK_YIELD_SPINS 64
+#endif
+
+// a ticket lock, so the cores acquire a contended lock in turn
 struct _spin_lock_t {
-    SDL_SpinLock sdl_spin_lock;
+    atomic_uint next_ticket;
+    atomic_uint now_serving;
+#if PICO_HOST_SPIN_LOCK_STATS
+    // when the holder acquired it; only touched by the holder
+    uint64_t acquired_ticks;
+    atomic_uint_fast64_t acquisitions;
+    atomic_uint_fast64_t contended;
+    atomic_uint_fast64_t spins;
+    atomic_uint_fast64_t max_hold_ticks;
+#endif
 };
 
 static spin_lock_t spin_locks[NUM_SPIN_LOCKS];
 
+static inline void cpu_pause(void) {
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_ia32_pause();
+#elif defined(__aarch64__) || defined(__arm__)
+    __asm__ volatile ("yield");
+#endif
+}
+
 spin_lock_t *spin_lock_instance(uint lock_num) {
     assert(lock_num >= 0 && lock_num < NUM_SPIN_LOCKS);
     return spin_locks + lock_num;
@@ -1554,18 +2096,113 @@ void spin_lock_unsafe_blocking(spin_lock_t *lock) {
     // Note we don't do a wfe or anything, because by convention these spin_locks are VERY SHORT LIVED and NEVER BLOCK and run
     // with INTERRUPTS disabled (to ensure that)... therefore nothing on our core could be blocking us, so we just need to wait on another core
     // anyway which should be finished soon
-    //while (!__builtin_expect(SDL_AtomicCAS(lock, SPINLOCK_UNLOCKED, SPINLOCK_LOCKED), SDL_TRUE));
-    SDL_AtomicLock(&lock->sdl_spin_lock);
-    atomic_thread_fence(memory_order_acquire);
+    uint ticket = atomic_fetch_add_explicit(&lock->next_ticket, 1, memory_order_relaxed);
+    uint serving = atomic_load_explicit(&lock->now_serving, memory_order_acquire);
+    if (serving != ticket) {
+        // only contended acquires are timed, as the clocks cost more than an uncontended lock
+        enum host_core_time_state previous = host_core_time_enter(HOST_CORE_TIME_SPIN_LOCK);
+        uint64_t spins = 0;
+        do {
+            for (uint i = (ticket - serving) * PICO_HOST_SPIN_LOCK_BACKOFF_PAUSES; i; i--) cpu_pause();
+            if (++spins % PICO_HOST_SPIN_LOCK_YIELD_SPINS == 0) SDL_Delay(0);
+            serving = atomic_load_explicit(&lock->now_serving, memory_order_acquire);
+        } while (serving != ticket);
+        host_core_time_leave(previous);
+#if PICO_HOST_SPIN_LOCK_STATS
+        atomic_fetch_add_explicit(&lock->contended, 1, memory_order_relaxed);
+        atomic_fetch_add_explicit(&lock->spins, spins, memory_order_relaxed);
+#endif
+    }
+#if PICO_HOST_SPIN_LOCK_STATS
+    atomic_fetch_add_explicit(&lock->acquisitions, 1, memory_order_relaxed);
+    lock->acquired_ticks = SDL_GetPerformanceCounter();
+#endif
+    host_trace_begin(HOST_TRACE_SPIN_LOCK, lock - spin_locks);
 }
 
 void spin_unlock_unsafe(spin_lock_t *lock) {
-    atomic_thread_fence(memory_order_release);
-    SDL_AtomicUnlock(&lock->sdl_spin_lock);
+    host_trace_end(HOST_TRACE_SPIN_LOCK, lock - spin_locks);
+#if PICO_HOST_SPIN_LOCK_STATS
+    uint64_t held = SDL_GetPerformanceCounter() - lock->acquired_ticks;
+    uint64_t max_held = atomic_load_explicit(&lock->max_hold_ticks, memory_order_relaxed);
+    while (held > max_held &&
+           !atomic_compare_exchange_weak_explicit(&lock->max_hold_ticks, &max_held, held, memory_order_relaxed,
+                                                  memory_order_relaxed)) {
+    }
+#endif
+    // only the holder changes now_serving. Unlocking a free lock must leave it free (as the SDK does to initialize
+    // a lock), rather than put now_serving ahead of every ticket
+    uint serving = atomic_load_explicit(&lock->now_serving, memory_order_relaxed);
+    if (serving != atomic_load_explicit(&lock->next_ticket, memory_order_relaxed)) {
+        atomic_store_explicit(&lock->now_serving, serving + 1, memory_order_release);
+    }
 }
 
 bool is_spin_locked(const spin_lock_t *lock) {
-    return lock->sdl_spin_lock != 0;
+    return atomic_load(&((spin_lock_t *) lock)->next_ticket) != atomic_load(&((spin_lock_t *) lock)->now_serving);
+}
+
+void host_spin_lock_get_stats(uint lock_num, struct host_spin_lock_stats *stats) {
+    assert(lock_num < NUM_SPIN_LOCKS);
+    memset(stats, 0, sizeof(*stats));
+#if PICO_HOST_SPIN_LOCK_STATS
+    spin_lock_t *lock = spin_locks + lock_num;
+    stats->acquisitions = atomic_load_explicit(&lock->acquisitions, memory_order_relaxed);
+    stats->contended = atomic_load_explicit(&lock->contended, memory_order_relaxed);
+    stats->spins = atomic_load_explicit(&lock->spins, memory_order_relaxed);
+    uint64_t max_hold_us = atomic_load_explicit(&lock->max_hold_ticks, memory_order_relaxed) * 1000000 /
+                           SDL_GetPerformanceFrequency();
+    stats->max_hold_us = (uint32_t) MIN(max_hold_us, UINT32_MAX);
+#endif
+}
+
+void host_spin_lock_reset_stats(void) {
+#if PICO_HOST_SPIN_LOCK_STATS
+    for (uint i = 0; i < NUM_SPIN_LOCKS; i++) {
+        atomic_store(&spin_locks[i].acquisitions, 0);
+        atomic_store(&spin_locks[i].contended, 0);
+        atomic_store(&spin_locks[i].spins, 0);
+        atomic_store(&spin_locks[i].max_hold_ticks, 0);
+    }
+#endif
+}
+
+// what the SDK uses the lock for, where that is fixed
+static const char *spin_lock_use(uint lock_num) {
+#ifdef PICO_SPINLOCK_ID_IRQ
+    if (lock_num == PICO_SPINLOCK_ID_IRQ) return "irq";
+#endif
+#ifdef PICO_SPINLOCK_ID_TIMER
+    if (lock_num == PICO_SPINLOCK_ID_TIMER) return "timer";
+#endif
+#ifdef PICO_SPINLOCK_ID_HARDWARE_CLAIM
+    if (lock_num == PICO_SPINLOCK_ID_HARDWARE_CLAIM) return "hardware claim";
+#endif
+#ifdef PICO_SPINLOCK_ID_RAND
+    if (lock_num == PICO_SPINLOCK_ID_RAND) return "rand";
+#endif
+#if defined(PICO_SPINLOCK_ID_STRIPED_FIRST) && defined(PICO_SPINLOCK_ID_STRIPED_LAST)
+    if (lock_num >= PICO_SPINLOCK_ID_STRIPED_FIRST && lock_num <= PICO_SPINLOCK_ID_STRIPED_LAST) return "striped";
+#endif
+#if defined(PICO_SPINLOCK_ID_CLAIM_FREE_FIRST) && defined(PICO_SPINLOCK_ID_CLAIM_FREE_LAST)
+    if (lock_num >= PICO_SPINLOCK_ID_CLAIM_FREE_FIRST && lock_num <= PICO_SPINLOCK_ID_CLAIM_FREE_LAST) return "claimed";
+#endif
+    return "";
+}
+
+void host_spin_lock_print_stats(void) {
+#if PICO_HOST_SPIN_LOCK_STATS
+    printf("Spin lock      acquisitions    contended        spins  max hold us\n");
+    for (uint i = 0; i < NUM_SPIN_LOCKS; i++) {
+        struct host_spin_lock_stats stats;
+        host_spin_lock_get_stats(i, &stats);
+        if (!stats.acquisitions) continue;
+        printf("%2u %-14s %12llu %12llu %12llu %12u\n", i, spin_lock_use(i), (unsigned long long) stats.acquisitions,
+               (unsigned long long) stats.contended, (unsigned long long) stats.spins, (uint) stats.max_hold_us);
+    }
+#else
+    printf("Spin lock stats not enabled (PICO_HOST_SPIN_LOCK_STATS)\n");
+#endif
 }
 
 uint32_t spin_lock_blocking(spin_lock_t *lock) {
@@ -1589,24 +2226,33 @@ int gpio_get(int i) {
 }
 
 void tight_loop_contents() {
+    enum host_core_time_state previous = host_core_time_enter(HOST_CORE_TIME_TIGHT_LOOP);
     SDL_Delay(1);
+    host_core_time_leave(previous);
 }
 
 void __sev() {
     SDL_LockMutex(cpu_event_mutex);
-    cpu_event_states = (1 << NUM_CORES) - 1;
+    cpu_event_states = (1u << HOST_THREAD_COUNT) - 1;
     SDL_CondBroadcast(cpu_event_condition);
     SDL_UnlockMutex(cpu_event_mutex);
 }
 
 void __wfe() {
+    uint64_t start = SDL_GetPerformanceCounter();
+    enum host_thread_id thread = host_thread_id();
+    host_trace_begin(HOST_TRACE_WFE, thread);
+    enum host_core_time_state previous = host_core_time_enter(HOST_CORE_TIME_WFE);
     SDL_LockMutex(cpu_event_mutex);
-    uint32_t bit = 1 << get_core_num();
+    uint32_t bit = 1u << thread;
     while (!(cpu_event_states & bit)) {
         SDL_CondWait(cpu_event_condition, cpu_event_mutex);
     }
     cpu_event_states &= ~bit;
     SDL_UnlockMutex(cpu_event_mutex);
+    host_core_time_leave(previous);
+    if (thread < NUM_CORES) atomic_fetch_add(&wfe_ticks[thread], SDL_GetPerformanceCounter() - start);
+    host_trace_end(HOST_TRACE_WFE, thread);
 }
 
 void irq_set_enabled(uint num, bool enable) {